@@ -0,0 +1,63 @@
+#include <batchfind.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define LOOKUPS 2000000
+
+// tree sizes come from argv; 100M nodes needs roughly 5 GB of memory
+static const size_t default_sizes[] = {1000000, 4000000, 16000000};
+
+static void run(const size_t n) {
+  const size_t inflight[] = {8, 16, 32};
+  key_t *probes = malloc(LOOKUPS * sizeof(key_t));
+  node_t **res = malloc(LOOKUPS * sizeof(node_t *));
+  rbtree *t = new_rbtree();
+
+  srand(34);
+  for (size_t i = 0; i < n; i++) {
+    rbtree_insert(t, rand());
+  }
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    probes[i] = rand();
+  }
+
+  size_t hits = 0;
+  double start = now_sec();
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    res[i] = rbtree_find(t, probes[i]);
+    hits += res[i] != NULL;
+  }
+  const double seq_ns = (now_sec() - start) * 1e9 / LOOKUPS;
+  printf("%10zu nodes  sequential %6.1f ns/find", n, seq_ns);
+
+  for (size_t k = 0; k < sizeof(inflight) / sizeof(inflight[0]); k++) {
+    start = now_sec();
+    batchfind_run(t, probes, res, LOOKUPS, inflight[k]);
+    const double ns = (now_sec() - start) * 1e9 / LOOKUPS;
+    printf("  x%-2zu %6.1f ns (%.2fx)", inflight[k], ns, seq_ns / ns);
+  }
+  printf("  hits %zu\n", hits);
+
+  delete_rbtree(t);
+  free(res);
+  free(probes);
+}
+
+int main(int argc, char *argv[]) {
+  printf("%d random finds per size, interleaved with x lookups in flight\n",
+         LOOKUPS);
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      run(strtoull(argv[i], NULL, 10));
+    }
+  } else {
+    for (size_t i = 0; i < sizeof(default_sizes) / sizeof(default_sizes[0]);
+         i++) {
+      run(default_sizes[i]);
+    }
+  }
+  return 0;
+}
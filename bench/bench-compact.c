@@ -0,0 +1,85 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define LOOKUPS 2000000
+#define SCANS 5
+
+static const size_t default_sizes[] = {100000, 1000000, 4000000};
+
+static void measure(rbtree *t, const key_t *probes, key_t *arr, const size_t n,
+                    const char *label) {
+  size_t hits = 0;
+  double start = now_sec();
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    hits += rbtree_find(t, probes[i]) != NULL;
+  }
+  const double find_ns = (now_sec() - start) * 1e9 / LOOKUPS;
+
+  start = now_sec();
+  for (int i = 0; i < SCANS; i++) {
+    rbtree_to_array(t, arr, n);
+  }
+  const double scan_ns = (now_sec() - start) * 1e9 / SCANS / n;
+  printf("  %-10s find %6.1f ns  to_array %5.2f ns/key  hits %zu\n", label,
+         find_ns, scan_ns, hits);
+}
+
+static void run(const size_t n) {
+  key_t *keys = malloc(n * sizeof(key_t));
+  key_t *probes = malloc(LOOKUPS * sizeof(key_t));
+  key_t *arr = malloc(n * sizeof(key_t));
+  rbtree *t = new_rbtree();
+
+  // churn: replace every key twice so that neighbours scatter over the heap
+  srand(35);
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = rand();
+    rbtree_insert(t, keys[i]);
+  }
+  for (size_t i = 0; i < 2 * n; i++) {
+    const size_t j = rand() % n;
+    rbtree_erase(t, rbtree_find(t, keys[j]));
+    keys[j] = rand();
+    rbtree_insert(t, keys[j]);
+  }
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    probes[i] = keys[rand() % n];
+  }
+
+  printf("%zu nodes after %zu replacements\n", n, 2 * n);
+  measure(t, probes, arr, n, "churned");
+
+  double start = now_sec();
+  rbtree_compact(t, RBTREE_LAYOUT_INORDER);
+  printf("  compact in-order %.1f ms\n", (now_sec() - start) * 1e3);
+  measure(t, probes, arr, n, "in-order");
+
+  start = now_sec();
+  rbtree_compact(t, RBTREE_LAYOUT_VEB);
+  printf("  compact vEB %.1f ms\n", (now_sec() - start) * 1e3);
+  measure(t, probes, arr, n, "vEB");
+
+  delete_rbtree(t);
+  free(arr);
+  free(probes);
+  free(keys);
+}
+
+int main(int argc, char *argv[]) {
+  printf("%d random finds of present keys, %d full to_array scans\n", LOOKUPS,
+         SCANS);
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      run(strtoull(argv[i], NULL, 10));
+    }
+  } else {
+    for (size_t i = 0; i < sizeof(default_sizes) / sizeof(default_sizes[0]);
+         i++) {
+      run(default_sizes[i]);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,45 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+// duplicate-heavy input: few distinct keys, many occurrences each
+#define DISTINCT 4096
+#define TOTAL 4000000
+
+static void run(const char *name, const int counted, const key_t *keys) {
+  const rbtree_opts_t opts = {.counted = counted};
+  const size_t before = heap_in_use();
+  const double start = now_sec();
+
+  rbtree *t = new_rbtree_opts(&opts);
+  for (size_t i = 0; i < TOTAL; i++) {
+    rbtree_insert(t, keys[i]);
+  }
+  const double elapsed = now_sec() - start;
+  const size_t bytes = heap_in_use() - before;
+
+  size_t total = 0;
+  for (key_t k = 0; k < DISTINCT; k++) {
+    total += rbtree_count(t, k);
+  }
+  printf("%-8s node %2zu B  heap %10zu B (%6.2f B/key)  insert %6.1f ns/op  "
+         "count total %zu\n",
+         name, t->node_size, bytes, (double)bytes / TOTAL,
+         elapsed * 1e9 / TOTAL, total);
+  delete_rbtree(t);
+}
+
+int main(void) {
+  key_t *keys = malloc(TOTAL * sizeof(key_t));
+  srand(27);
+  for (size_t i = 0; i < TOTAL; i++) {
+    keys[i] = rand() % DISTINCT;
+  }
+  printf("%d inserts over %d distinct keys\n", TOTAL, DISTINCT);
+  run("plain", 0, keys);
+  run("counted", 1, keys);
+  free(keys);
+  return 0;
+}
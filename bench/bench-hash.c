@@ -0,0 +1,53 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define N 1000000
+#define LOOKUPS 4000000
+
+static void run(const char *name, const int hash_index, const key_t *keys,
+                const key_t *probes) {
+  const rbtree_opts_t opts = {.hash_index = hash_index};
+  const size_t before = heap_in_use();
+
+  rbtree *t = new_rbtree_opts(&opts);
+  double start = now_sec();
+  for (size_t i = 0; i < N; i++) {
+    rbtree_insert(t, keys[i]);
+  }
+  const double insert_ns = (now_sec() - start) * 1e9 / N;
+  const size_t bytes = heap_in_use() - before;
+
+  size_t hits = 0;
+  start = now_sec();
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    hits += rbtree_find(t, probes[i]) != NULL;
+  }
+  const double find_ns = (now_sec() - start) * 1e9 / LOOKUPS;
+
+  printf("%-8s heap %10zu B (%5.1f B/key)  insert %6.1f ns/op  "
+         "find %6.1f ns/op  hits %zu\n",
+         name, bytes, (double)bytes / N, insert_ns, find_ns, hits);
+  delete_rbtree(t);
+}
+
+int main(void) {
+  key_t *keys = malloc(N * sizeof(key_t));
+  key_t *probes = malloc(LOOKUPS * sizeof(key_t));
+  srand(28);
+  for (size_t i = 0; i < N; i++) {
+    keys[i] = rand();
+  }
+  // 90% hits, 10% misses
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    probes[i] = rand() % 10 ? keys[rand() % N] : -rand() - 1;
+  }
+  printf("%d keys, %d random finds\n", N, LOOKUPS);
+  run("tree", 0, keys, probes);
+  run("indexed", 1, keys, probes);
+  free(probes);
+  free(keys);
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define N 1000000
+#define HOLDS 1000000
+
+// array-backed binary min-heap as the reference priority queue
+typedef struct {
+  key_t *a;
+  size_t n;
+} heap_t;
+
+static void heap_push(heap_t *h, const key_t key) {
+  size_t i = h->n++;
+  while (i > 0 && h->a[(i - 1) / 2] > key) {
+    h->a[i] = h->a[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  h->a[i] = key;
+}
+
+static key_t heap_pop(heap_t *h) {
+  const key_t top = h->a[0];
+  const key_t last = h->a[--h->n];
+  size_t i = 0;
+  for (;;) {
+    size_t c = 2 * i + 1;
+    if (c >= h->n) break;
+    if (c + 1 < h->n && h->a[c + 1] < h->a[c]) c++;
+    if (h->a[c] >= last) break;
+    h->a[i] = h->a[c];
+    i = c;
+  }
+  h->a[i] = last;
+  return top;
+}
+
+// pre-cache rbtree_min: descend the left spine from the root
+static key_t walk_pop_min(rbtree *t) {
+  node_t *p = t->root;
+  while (p->left != t->nil) p = p->left;
+  const key_t key = p->key;
+  rbtree_erase(t, p);
+  return key;
+}
+
+typedef enum { PQ_HEAP, PQ_TREE_CACHED, PQ_TREE_WALK } pq_kind_t;
+
+static void run(const char *name, const pq_kind_t kind, const key_t *keys,
+                const key_t *deltas) {
+  heap_t h = {malloc(N * sizeof(key_t)), 0};
+  rbtree *t = new_rbtree();
+  long long checksum = 0;
+  key_t key;
+
+  const double start = now_sec();
+  for (size_t i = 0; i < N; i++) {
+    if (kind == PQ_HEAP) heap_push(&h, keys[i]);
+    else rbtree_insert(t, keys[i]);
+  }
+  const double filled = now_sec();
+
+  // classic "hold" model: pop the earliest event, schedule a later one
+  for (size_t i = 0; i < HOLDS; i++) {
+    if (kind == PQ_HEAP) key = heap_pop(&h);
+    else if (kind == PQ_TREE_WALK) key = walk_pop_min(t);
+    else rbtree_pop_min(t, &key);
+    checksum += key;
+    if (kind == PQ_HEAP) heap_push(&h, key + deltas[i]);
+    else rbtree_insert(t, key + deltas[i]);
+  }
+  const double held = now_sec();
+
+  for (size_t i = 0; i < N; i++) {
+    if (kind == PQ_HEAP) key = heap_pop(&h);
+    else if (kind == PQ_TREE_WALK) key = walk_pop_min(t);
+    else rbtree_pop_min(t, &key);
+    checksum += key;
+  }
+  const double drained = now_sec();
+
+  printf("%-12s fill %6.1f ns/op  hold %6.1f ns/op  drain %6.1f ns/op  "
+         "checksum %lld\n",
+         name, (filled - start) * 1e9 / N, (held - filled) * 1e9 / HOLDS,
+         (drained - held) * 1e9 / N, checksum);
+  free(h.a);
+  delete_rbtree(t);
+}
+
+int main(void) {
+  key_t *keys = malloc(N * sizeof(key_t));
+  key_t *deltas = malloc(HOLDS * sizeof(key_t));
+  srand(29);
+  for (size_t i = 0; i < N; i++) {
+    keys[i] = rand() % (1 << 30);
+  }
+  for (size_t i = 0; i < HOLDS; i++) {
+    deltas[i] = rand() % (1 << 20);
+  }
+  printf("priority queue with %d entries, %d holds\n", N, HOLDS);
+  run("binary heap", PQ_HEAP, keys, deltas);
+  run("rbtree", PQ_TREE_CACHED, keys, deltas);
+  run("rbtree walk", PQ_TREE_WALK, keys, deltas);
+  free(deltas);
+  free(keys);
+  return 0;
+}
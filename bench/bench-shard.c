@@ -0,0 +1,83 @@
+#include <pthread.h>
+#include <rbtree.h>
+#include <shardtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define N 2000000
+
+typedef struct {
+  shardtree *s;                // sharded: each writer owns a shard
+  rbtree *t;                   // locked: everybody shares one tree
+  pthread_mutex_t *lock;
+  const key_t *keys;
+  size_t n;
+} writer_t;
+
+static void *sharded_writer(void *arg) {
+  writer_t *w = (writer_t *)arg;
+  const int shard = shardtree_claim(w->s);
+  for (size_t i = 0; i < w->n; i++) {
+    shardtree_insert(w->s, shard, w->keys[i]);
+  }
+  return NULL;
+}
+
+static void *locked_writer(void *arg) {
+  writer_t *w = (writer_t *)arg;
+  for (size_t i = 0; i < w->n; i++) {
+    pthread_mutex_lock(w->lock);
+    rbtree_insert(w->t, w->keys[i]);
+    pthread_mutex_unlock(w->lock);
+  }
+  return NULL;
+}
+
+static double run(const int sharded, const size_t nthreads, const key_t *keys) {
+  pthread_t tids[64];
+  writer_t writers[64];
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  shardtree *s = sharded ? new_shardtree(nthreads, NULL) : NULL;
+  rbtree *t = sharded ? NULL : new_rbtree();
+  const size_t per_thread = N / nthreads;
+
+  const double start = now_sec();
+  for (size_t i = 0; i < nthreads; i++) {
+    writers[i] = (writer_t){s, t, &lock, keys + i * per_thread, per_thread};
+    pthread_create(&tids[i], NULL, sharded ? sharded_writer : locked_writer,
+                   &writers[i]);
+  }
+  for (size_t i = 0; i < nthreads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  const double elapsed = now_sec() - start;
+
+  if (sharded) {
+    delete_shardtree(s);
+  } else {
+    delete_rbtree(t);
+  }
+  return per_thread * nthreads / elapsed / 1e6;
+}
+
+int main(void) {
+  const size_t threads[] = {1, 2, 4, 8};
+  key_t *keys = malloc(N * sizeof(key_t));
+  srand(31);
+  for (size_t i = 0; i < N; i++) {
+    keys[i] = rand();
+  }
+  printf("%d random inserts, Mops/s (%ld online cpus)\n", N,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+    const double locked = run(0, threads[i], keys);
+    const double sharded = run(1, threads[i], keys);
+    printf("threads %zu  locked %6.2f  sharded %6.2f\n", threads[i], locked,
+           sharded);
+  }
+  free(keys);
+  return 0;
+}
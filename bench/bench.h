@@ -0,0 +1,20 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <malloc.h>
+#include <stddef.h>
+#include <time.h>
+
+// bytes currently handed out by malloc, mmap-backed blocks included
+static inline size_t heap_in_use(void) {
+  const struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+static inline double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif  // _BENCH_H_
@@ -0,0 +1,153 @@
+#include "batchfind.h"
+
+#include <stdlib.h>
+
+/*
+* Each lookup is a tiny state machine whose whole state is the next node to
+* visit. Stepping a lookup compares one node, issues a prefetch for the
+* child it moves to and yields to the next lookup, so by the time it runs
+* again the child is (ideally) in cache. With k lookups in flight a single
+* core keeps up to k misses outstanding instead of one.
+*/
+
+static int batchfind_step(const batchfind *, batchfind_slot_t *, node_t **);
+
+/*
+* @details Creates a lookup engine over a tree.
+* @param[in] t - A pointer to the rbtree to search; must not change while lookups run.
+* @param[in] inflight - How many lookups to interleave, e.g. 8-32.
+* @return A pointer to the newly created engine.
+*/
+batchfind *new_batchfind(const rbtree *t, const size_t inflight) {
+  batchfind *b = (batchfind *)calloc(1, sizeof(batchfind));
+
+  b->t = t;
+  b->inflight = inflight > 0 ? inflight : 1;
+  b->slots = (batchfind_slot_t *)calloc(b->inflight, sizeof(batchfind_slot_t));
+  return b;
+}
+
+/*
+* @details Deallocates a lookup engine; pending lookups are dropped.
+* @param[in] b - A pointer to the engine.
+* @return void
+*/
+void delete_batchfind(batchfind *b) {
+  free(b->slots);
+  free(b);
+}
+
+/*
+* @details Starts a lookup if a slot is free.
+* @param[in] b - A pointer to the engine.
+* @param[in] key - The key value to search for.
+* @param[in] tag - Caller data handed back with the result.
+* @return int - Returns 0 if the lookup was started, -1 if every slot is busy.
+*/
+int batchfind_submit(batchfind *b, const key_t key, void *tag) {
+  if (b->active == b->inflight)
+    return -1;
+
+  for (size_t i = 0; i < b->inflight; i++) {
+    batchfind_slot_t *slot = &b->slots[i];
+    if (slot->cur == NULL) {
+      slot->key = key;
+      slot->tag = tag;
+      slot->cur = b->t->root;
+      __builtin_prefetch(slot->cur);
+      b->active++;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*
+* @details Steps the in-flight lookups round-robin until some finish.
+* @param[in] b - A pointer to the engine.
+* @param[out] out - Receives the finished lookups.
+* @param[in] max - The capacity of out.
+* @return size_t - The number of results written; 0 only if nothing is in flight.
+*/
+size_t batchfind_complete(batchfind *b, batchfind_result_t *out, const size_t max) {
+  size_t done = 0;
+
+  while (b->active > 0 && done < max) {
+    batchfind_slot_t *slot = &b->slots[b->next];
+    node_t *found;
+
+    if (slot->cur != NULL && batchfind_step(b, slot, &found)) {
+      out[done].tag = slot->tag;
+      out[done].node = found;
+      done++;
+      slot->cur = NULL;
+      b->active--;
+    }
+    b->next = b->next + 1 < b->inflight ? b->next + 1 : 0;
+
+    // report back after a full sweep so the caller can refill the slots
+    if (done > 0 && b->next == 0)
+      break;
+  }
+  return done;
+}
+
+/*
+* @details Looks up n keys with a fixed number of lookups in flight.
+*          Results match rbtree_find() on the tree walk.
+* @param[in] t - A pointer to the rbtree to search.
+* @param[in] keys - The keys to look up.
+* @param[out] out - Receives the node found for keys[i] (or NULL) at out[i].
+* @param[in] n - The number of keys.
+* @param[in] inflight - How many lookups to interleave.
+* @return void
+*/
+void batchfind_run(const rbtree *t, const key_t *keys, node_t **out,
+                   const size_t n, const size_t inflight) {
+  batchfind *b = new_batchfind(t, inflight);
+  size_t submitted = 0;
+
+  // refill a slot the moment its lookup finishes so the pipeline stays full
+  for (size_t i = 0; submitted < n || b->active > 0; i = i + 1 < b->inflight ? i + 1 : 0) {
+    batchfind_slot_t *slot = &b->slots[i];
+    node_t *found;
+
+    if (slot->cur != NULL && batchfind_step(b, slot, &found)) {
+      out[(size_t)slot->tag] = found;
+      slot->cur = NULL;
+      b->active--;
+    }
+    if (slot->cur == NULL && submitted < n) {
+      slot->key = keys[submitted];
+      slot->tag = (void *)submitted;
+      slot->cur = t->root;
+      __builtin_prefetch(slot->cur);
+      submitted++;
+      b->active++;
+    }
+  }
+  delete_batchfind(b);
+}
+
+/*
+* @details Advances one lookup by a single node.
+* @param[in] b - A pointer to the engine.
+* @param[in] slot - A pointer to an active slot.
+* @param[out] found - Receives the result once the lookup finishes.
+* @return int - Returns 1 if the lookup finished, 0 if it moved to a child.
+*/
+static int batchfind_step(const batchfind *b, batchfind_slot_t *slot, node_t **found) {
+  node_t *current_node = slot->cur;
+
+  if (current_node == b->t->nil) {
+    *found = NULL;
+    return 1;
+  }
+  if (current_node->key == slot->key) {
+    *found = current_node;
+    return 1;
+  }
+  slot->cur = current_node->key < slot->key ? current_node->right : current_node->left;
+  __builtin_prefetch(slot->cur);
+  return 0;
+}
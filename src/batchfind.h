@@ -0,0 +1,38 @@
+#ifndef _BATCHFIND_H_
+#define _BATCHFIND_H_
+
+#include <stddef.h>
+
+#include "rbtree.h"
+
+// one suspended lookup: the node it will compare against next
+typedef struct {
+  key_t key;
+  void *tag;
+  node_t *cur;  // NULL when the slot is free
+} batchfind_slot_t;
+
+typedef struct {
+  void *tag;
+  node_t *node;  // NULL if the key is not in the tree
+} batchfind_result_t;
+
+// interleaves many rbtree_find descents so their cache misses overlap
+typedef struct {
+  const rbtree *t;
+  batchfind_slot_t *slots;
+  size_t inflight;  // number of slots
+  size_t active;
+  size_t next;  // round-robin position
+} batchfind;
+
+batchfind *new_batchfind(const rbtree *, const size_t);
+void delete_batchfind(batchfind *);
+
+int batchfind_submit(batchfind *, const key_t, void *);
+size_t batchfind_complete(batchfind *, batchfind_result_t *, const size_t);
+
+void batchfind_run(const rbtree *, const key_t *, node_t **, const size_t,
+                   const size_t);
+
+#endif  // _BATCHFIND_H_
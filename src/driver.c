@@ -1,14 +1,167 @@
 #include "rbtree.h"
-#include "assert.h"
-#include "stdio.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Benchmark driver comparing the balancing engines behind the rbtree API.
+//
+// Every engine starts from the same random tree and replays the same
+// operation stream per workload. For each run it reports throughput, the
+// mean and maximum depth of a node (the cost of a lookup in node visits)
+// and the rotations done per insert or erase.
+//
+//   driver [-n nodes] [-o ops] [-l scan length] [-s seed]
+
+typedef struct {
+  const char *name;
+  int find, insert, erase;  // percent of operations; the rest are scans
+} workload_t;
+
+static const workload_t workloads[] = {
+    {"read-heavy", 90, 5, 5},
+    {"write-heavy", 10, 45, 45},
+    {"scan-heavy", 10, 5, 5},
+};
+
+static const char *engine_names[] = {"rb", "avl", "treap"};
+
+// keeps the lookups and scans from being optimized away
+static volatile size_t sink;
+
+typedef struct {
+  size_t nodes, ops, scan_len;
+  unsigned seed;
+} config_t;
+
+static unsigned next_rand(unsigned *state) {
+  unsigned x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// mean node depth (root at depth 1) and height; one parent walk per node
+static void measure_depth(const rbtree *t, double *mean, int *height) {
+  size_t total = 0, nodes = 0;
+
+  *height = 0;
+  for (const node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) {
+    int depth = 0;
+    for (const node_t *q = p; q != t->nil; q = q->parent)
+      depth++;
+    total += depth;
+    nodes++;
+    if (depth > *height)
+      *height = depth;
+  }
+  *mean = nodes ? (double)total / nodes : 0;
+}
+
+static void run(const rbtree_engine_t engine, const workload_t *w,
+                const config_t *cfg) {
+  const rbtree_opts_t opts = {.engine = engine};
+  rbtree *t = new_rbtree_opts(&opts);
+  key_t *keys = malloc((cfg->nodes + cfg->ops) * sizeof(key_t));
+  size_t nkeys = 0;
+  unsigned state = cfg->seed;
+
+  for (size_t i = 0; i < cfg->nodes; i++) {
+    keys[nkeys] = next_rand(&state);
+    rbtree_insert(t, keys[nkeys++]);
+  }
+
+  const size_t rotations = t->rotations;
+  size_t updates = 0, visited = 0;
+  const double start = now_sec();
+  for (size_t i = 0; i < cfg->ops; i++) {
+    const unsigned r = next_rand(&state);
+    const int pick = r % 100;
+    const key_t key = keys[(r >> 7) % nkeys];
+
+    if (pick < w->find) {
+      visited += rbtree_find(t, key) != NULL;
+    }
+    else if (pick < w->find + w->insert) {
+      keys[nkeys] = next_rand(&state);
+      rbtree_insert(t, keys[nkeys++]);
+      updates++;
+    }
+    else if (pick < w->find + w->insert + w->erase) {
+      if (nkeys > 1) {
+        const size_t j = (r >> 7) % nkeys;
+        rbtree_erase(t, rbtree_find(t, keys[j]));
+        keys[j] = keys[--nkeys];
+        updates++;
+      }
+    }
+    else {
+      const node_t *p = rbtree_find(t, key);
+      for (size_t k = 0; p != NULL && k < cfg->scan_len; k++) {
+        p = rbtree_next(t, p);
+        visited++;
+      }
+    }
+  }
+  const double elapsed = now_sec() - start;
+
+  double mean;
+  int height;
+  measure_depth(t, &mean, &height);
+  sink = visited;
+  printf("%-6s %-12s %8.2f %9.2f %6d %9.3f\n", engine_names[engine], w->name,
+         cfg->ops / elapsed / 1e6, mean, height,
+         updates ? (double)(t->rotations - rotations) / updates : 0.0);
+
+  delete_rbtree(t);
+  free(keys);
+}
 
 int main(int argc, char *argv[]) {
-    rbtree *t = new_rbtree();
-    rbtree_insert(t, 36);
-    rbtree_insert(t, 25);
-    rbtree_insert(t, 990);
-    node_t *p = rbtree_find(t, 36);
-    rbtree_erase(t, p);
-    return 0;
-}
\ No newline at end of file
+  config_t cfg = {1000000, 1000000, 16, 36};
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:o:l:s:")) != -1) {
+    switch (opt) {
+      case 'n':
+        cfg.nodes = strtoull(optarg, NULL, 10);
+        break;
+      case 'o':
+        cfg.ops = strtoull(optarg, NULL, 10);
+        break;
+      case 'l':
+        cfg.scan_len = strtoull(optarg, NULL, 10);
+        break;
+      case 's':
+        cfg.seed = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n nodes] [-o ops] [-l scan length] [-s seed]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (cfg.nodes == 0 || cfg.seed == 0) {
+    fprintf(stderr, "%s: need at least one node and a nonzero seed\n", argv[0]);
+    return 2;
+  }
+
+  printf("%zu random keys, %zu operations per run, scans of %zu nodes\n",
+         cfg.nodes, cfg.ops, cfg.scan_len);
+  printf("%-6s %-12s %8s %9s %6s %9s\n", "engine", "workload", "Mops/s",
+         "depth", "height", "rot/upd");
+  for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+    for (int e = RBTREE_ENGINE_RB; e <= RBTREE_ENGINE_TREAP; e++) {
+      run((rbtree_engine_t)e, &workloads[w], &cfg);
+    }
+  }
+  return 0;
+}
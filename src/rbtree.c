@@ -1,7 +1,13 @@
 #include "rbtree.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+// __GLIBC__ comes from the libc headers above
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 /*
 * malloc - void* malloc(size_t size);
   * 함수 호출 시 메모리의 크기를 바이트 단위로 전달하면 그 크기만큼 메모리 할당
@@ -25,76 +31,309 @@
 
 typedef enum { ROTATE_RIGHT, ROTATE_LEFT } rotate_dir_t;
 
+#define INDEX_MIN_CAPACITY 16
+
+// a contiguous block of node slots filled by one rbtree_compact_step
+struct rbtree_arena {
+  char *base;
+  size_t capacity;  // slots
+  size_t live;      // slots still holding a node
+  node_t *free;     // slots emptied since, chained through left
+  struct rbtree_arena *prev, *next;  // in t->reuse while free != NULL
+  unsigned char used[];  // one bit per slot
+};
+
+// an arena this empty pins too much memory; the next compaction empties it
+#define ARENA_SPARSE(a) ((a)->live * 4 < (a)->capacity)
+
+// one pending piece of a van Emde Boas layout: for every node skip levels
+// below node, its top levels levels, the upper half first
+struct veb_frame {
+  node_t *node;
+  int depth;  // of node, the root at 0
+  int skip, levels;
+};
+
+// state of a compaction spread over several rbtree_compact_step calls;
+// it holds node addresses, which moves and erases keep up to date
+struct rbtree_compaction {
+  rbtree_layout_t layout;
+  node_t *cursor;  // in-order: the last node moved, nil before the first
+  struct veb_frame *frames;  // vEB: pending pieces, the next one on top
+  size_t nframes, frames_capacity;
+  int height;  // vEB: levels planned for; deeper nodes follow in preorder
+};
+
 void *bstree_insert(rbtree *, node_t *);
 void *rbtree_insert_fixup(rbtree *, node_t *);
 void *rbtree_rotate(rbtree *, node_t *, const rotate_dir_t);
 void *rbtree_erase_fixup(rbtree *, node_t *);
-int rbtree_inorder(node_t *, key_t *, int);
+size_t rbtree_inorder(const rbtree *, node_t *, key_t *, size_t, const size_t);
 void *rbtree_transplant(rbtree *, node_t *, node_t *);
+static agg_t *node_agg(const node_t *);
+static size_t *node_count(const rbtree *, const node_t *);
+static agg_t rbtree_node_value(const rbtree *, const node_t *);
+static node_t *rbtree_link_node(rbtree *, node_t *);
+static void rbtree_unlink_node(rbtree *, node_t *);
+static node_t *rbtree_successor(const rbtree *, node_t *);
+static node_t *rbtree_predecessor(const rbtree *, node_t *);
+static void rbtree_augment_update(const rbtree *, node_t *);
+static void rbtree_augment_propagate(const rbtree *, node_t *);
+static agg_t rbtree_aggregate_from(const rbtree *, node_t *, const key_t);
+static agg_t rbtree_aggregate_to(const rbtree *, node_t *, const key_t);
+static size_t index_home(const rbtree_index_t *, const key_t);
+static node_t *index_lookup(const rbtree_index_t *, const key_t);
+static void index_add(rbtree *, node_t *);
+static void index_forget(rbtree *, node_t *);
+static void index_resize(rbtree *, const size_t);
+static void *rbtree_alloc(rbtree *, const size_t);
+static void rbtree_free(rbtree *, void *, const size_t);
+static void rbtree_account(rbtree *, const void *, const size_t, const int);
+static void rbtree_free_subtree(rbtree *, node_t *);
+static node_t *rbtree_alloc_node(rbtree *);
+static void rbtree_free_node(rbtree *, node_t *);
+static size_t arena_find(const rbtree *, const node_t *);
+static struct rbtree_arena *arena_new(rbtree *, const size_t);
+static void arena_remove(rbtree *, const size_t);
+static void arena_unreuse(rbtree *, struct rbtree_arena *);
+static void rbtree_arena_evacuate(rbtree *);
+static void rbtree_compact_begin(rbtree *, const rbtree_layout_t);
+static void rbtree_compact_abort(rbtree *);
+static node_t *rbtree_compact_next(rbtree *, struct rbtree_compaction *);
+static void rbtree_compact_moved(struct rbtree_compaction *, node_t *, node_t *);
+static void rbtree_compact_forget(rbtree *, node_t *);
+static void veb_push(rbtree *, struct rbtree_compaction *, node_t *, const int, const int, const int);
+static int veb_levels(const rbtree *);
+static void rbtree_relocate(rbtree *, node_t *, node_t *);
+static void avl_update_height(node_t *);
+static node_t *avl_rebalance(rbtree *, node_t *);
+static void avl_retrace(rbtree *, node_t *);
+static unsigned treap_priority(rbtree *);
+static void treap_sift_up(rbtree *, node_t *);
+static void treap_sift_down(rbtree *, node_t *);
+static void *libc_alloc(void *, const size_t);
+static void libc_free(void *, void *, const size_t);
+#ifdef __GLIBC__
+static size_t libc_usable_size(void *, const void *);
+
+// glibc keeps one size word in front of every chunk
+static const rbtree_allocator_t libc_allocator = {
+  libc_alloc, libc_free, libc_usable_size, sizeof(size_t), NULL
+};
+#else
+// elsewhere the usable size is unknown and taken to be the requested size
+static const rbtree_allocator_t libc_allocator = {
+  libc_alloc, libc_free, NULL, 0, NULL
+};
+#endif
 
 /* 
 * @details Create a new red-black tree (rbtree) and initialize its properties.
 * @return A pointer to the newly created rbtree.
 */
 rbtree *new_rbtree(void) {
+  return new_rbtree_opts(NULL);
+}
+
+/* 
+* @details Create a new red-black tree (rbtree) with the given options.
+* @param[in] opts - Tree options, or NULL for a plain tree.
+* @return A pointer to the newly created rbtree.
+*/
+rbtree *new_rbtree_opts(const rbtree_opts_t *opts) {
   /*
-  * void* calloc(size_t element_count, size_t element_size)
-    * element size 크기의 변수를 element count개 만큼 저장할 수 있는 메모리 공간을 할당
+  * 모든 할당은 allocator hook을 거친다 (기본값: libc malloc/free)
+    * rbtree_alloc이 calloc처럼 0으로 채우고 사용량을 기록
   */
 
+  const rbtree_allocator_t *allocator =
+      opts != NULL && opts->allocator != NULL ? opts->allocator : &libc_allocator;
+
   // Dynamic alloc for tree
-  // size of rbtree struct: 16 -> node_t pointer * 2
-  rbtree *p = (rbtree *)calloc(1, sizeof(rbtree));  // 16바이트 크기의 변수 1개를 담을 수 있는 공간을 동적 할당
+  rbtree *p = (rbtree *)allocator->alloc(allocator->ctx, sizeof(rbtree));
+  memset(p, 0, sizeof(rbtree));
+  p->allocator = *allocator;
+  rbtree_account(p, p, sizeof(rbtree), 1);
+
+  // augmented trees keep the aggregate right after node_t,
+  // plain trees pay nothing for it
+  p->node_size = sizeof(node_t);
+  if (opts != NULL && opts->augment != NULL) {
+    p->augment = *opts->augment;
+    p->node_size = sizeof(rbtree_aug_node_t);
+  }
+  // counted trees append the multiplicity after everything else
+  if (opts != NULL && opts->counted) {
+    p->count_offset = p->node_size;
+    p->node_size += sizeof(size_t);
+  }
 
   // Dynamic alloc for node
   // node_t: {color_t, key_t, struct node_t * 3}
   // size of node_t: 32 -> color_t: 4, key_t: 4, pointer * 3: 24
-  node_t *NIL = (node_t *)calloc(1, sizeof(node_t));  // 32바이트 크기의 변수 1개를 담을 수 있는 공간을 동적 할당
+  node_t *NIL = (node_t *)rbtree_alloc(p, p->node_size);
 
+  p->engine = opts != NULL ? opts->engine : RBTREE_ENGINE_RB;
+  p->seed = 2463534242u;
   NIL->color = RBTREE_BLACK;
+  if (p->engine == RBTREE_ENGINE_AVL)
+    NIL->height = 0;
+  if (opts != NULL && opts->augment != NULL)
+    *node_agg(NIL) = p->augment.identity;
 
   p->nil = NIL;
   p->root = NIL;
+  p->leftmost = NIL;
+  p->rightmost = NIL;
+
+  if (opts != NULL && opts->hash_index)
+    index_resize(p, INDEX_MIN_CAPACITY);
   return p;
 }
 
 /* 
 * @details Inserts a new node with the specified key into the red-black tree (rbtree).
-* @param[in] t - A pointer to the rbtree.
+*          A counted tree bumps the multiplicity of an existing node instead.
+* @param[in] t - A pointer to the rbtree; must not hold caller-owned nodes.
 * @param key - The key to be inserted.
-* @return A pointer to the root of the modified rbtree.
+* @return A pointer to the node holding the key, or NULL for a tree
+*         holding nodes linked with rbtree_link().
  */
 node_t *rbtree_insert(rbtree *t, const key_t key) {
+  // one tree holds either its own nodes or the caller's, never both
+  if (t->foreign_count != 0)
+    return NULL;
+  if (t->count_offset != 0) {
+    node_t *same_node = rbtree_find(t, key);
+    if (same_node != NULL) {
+      (*node_count(t, same_node))++;
+      rbtree_augment_propagate(t, same_node);
+      return same_node;
+    }
+  }
+
   // create new node
-  node_t *new_node = (node_t *)calloc(1, sizeof(node_t));
-  new_node->color = RBTREE_RED;
+  node_t *new_node = rbtree_alloc_node(t);
   new_node->key = key;
+  if (t->count_offset != 0)
+    *node_count(t, new_node) = 1;
+
+  return rbtree_link_node(t, new_node);
+}
+
+/*
+* @details Links a caller-owned node into the tree and rebalances.
+*          The tree never allocates or frees such nodes; embed node_t in your
+*          own struct and get back to it with rbtree_entry().
+*          Augmented trees need the node to be a rbtree_aug_node_t.
+* @param[in] t - A pointer to the rbtree; must not be counted nor hold
+*                nodes made by rbtree_insert().
+* @param[in] n - A pointer to an unlinked node with its key set.
+* @return node_t - The linked node, or NULL if the tree refuses it.
+*/
+node_t *rbtree_link(rbtree *t, node_t *n) {
+  // counted trees merge duplicates, which caller-owned nodes cannot do
+  if (t->count_offset != 0)
+    return NULL;
+  // delete_rbtree could not tell mixed nodes apart
+  if (t->node_count != t->foreign_count)
+    return NULL;
+  // a compaction left on an emptied tree has nothing more to move
+  rbtree_compact_abort(t);
+  t->foreign_count++;
+  return rbtree_link_node(t, n);
+}
+
+/*
+* @details Unlinks a node from the tree and rebalances without freeing it.
+* @param[in] t - A pointer to the rbtree; must not be counted.
+* @param[in] p - A pointer to a node linked with rbtree_link().
+* @return int - Returns 0 on success, -1 for a counted tree or one holding
+*               only nodes made by rbtree_insert().
+*/
+int rbtree_unlink(rbtree *t, node_t *p) {
+  if (t->count_offset != 0)
+    return -1;
+  // the tree's own nodes go through rbtree_erase
+  if (t->foreign_count == 0)
+    return -1;
+  t->foreign_count--;
+  rbtree_unlink_node(t, p);
+  return 0;
+}
+
+/*
+* @details Links a node into the tree, rebalances and updates the caches.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] new_node - A pointer to the node; only its key (and multiplicity) is read.
+* @return node_t - The linked node.
+*/
+static node_t *rbtree_link_node(rbtree *t, node_t *new_node) {
+  const key_t key = new_node->key;
+
+  t->node_count++;
+  if (t->engine == RBTREE_ENGINE_AVL)
+    new_node->height = 1;
+  else if (t->engine == RBTREE_ENGINE_TREAP)
+    new_node->priority = treap_priority(t);
+  else
+    new_node->color = RBTREE_RED;
   new_node->left = t->nil;
   new_node->right = t->nil;
   new_node->parent = t->nil;
+  if (t->augment.combine != NULL)
+    *node_agg(new_node) = rbtree_node_value(t, new_node);
 
   // insert new node
   // if root is null, insert root node
   if (t->root == t->nil) {
-    new_node->color = RBTREE_BLACK; // root node color: black
+    if (t->engine == RBTREE_ENGINE_RB)
+      new_node->color = RBTREE_BLACK; // root node color: black
     t->root = new_node;
+    t->leftmost = new_node;
+    t->rightmost = new_node;
   }
   else {
+    // a new extreme always lands right below the old one
+    if (key < t->leftmost->key)
+      t->leftmost = new_node;
+    if (key >= t->rightmost->key)
+      t->rightmost = new_node;
     bstree_insert(t, new_node);
-    rbtree_insert_fixup(t, new_node);
+    rbtree_augment_propagate(t, new_node->parent);
+    if (t->engine == RBTREE_ENGINE_AVL)
+      avl_retrace(t, new_node->parent);
+    else if (t->engine == RBTREE_ENGINE_TREAP)
+      treap_sift_up(t, new_node);
+    else
+      rbtree_insert_fixup(t, new_node);
   }
+  if (t->index.slots != NULL)
+    index_add(t, new_node);
 
-  return t->root;
+  return new_node;
 }
 
 /*
  * @details Deallocates memory for the entire red-black tree (rbtree) structure.
+ *          Caller-owned nodes are never freed; a tree holds either those
+ *          or its own nodes, never both.
  * @param[in] t - A pointer to the rbtree to be deleted.
  * @return void
  */
 void delete_rbtree(rbtree *t) {
-  // TODO: reclaim the tree nodes's memory
-  free(t);
+  const rbtree_allocator_t allocator = t->allocator;
+
+  rbtree_compact_abort(t);
+  if (t->foreign_count == 0)
+    rbtree_free_subtree(t, t->root);
+  // the arenas went away with their last nodes
+  if (t->arenas != NULL)
+    rbtree_free(t, t->arenas, t->arenas_capacity * sizeof(struct rbtree_arena *));
+  rbtree_free(t, t->nil, t->node_size);
+  if (t->index.slots != NULL)
+    rbtree_free(t, t->index.slots, (t->index.mask + 1) * sizeof(rbtree_index_slot_t));
+  allocator.free(allocator.ctx, t, sizeof(rbtree));
 }
 
 /*
@@ -106,6 +345,9 @@ void delete_rbtree(rbtree *t) {
 node_t *rbtree_find(const rbtree *t, const key_t key) {
   node_t *current_node = t->root;
 
+  if (t->index.slots != NULL)
+    return index_lookup(&t->index, key);
+
   while (current_node != t->nil) {
     if (current_node->key == key)
       return current_node;
@@ -120,40 +362,66 @@ node_t *rbtree_find(const rbtree *t, const key_t key) {
 /*
 * @details Finds the node with the minimum key in the red-black tree (rbtree).
 * @param[in] t - A pointer to the rbtree to search in.
-* @return node_t - A pointer to the node with the minimum key.
+* @return node_t - A pointer to the node with the minimum key, or NULL if empty.
 */
 node_t *rbtree_min(const rbtree *t) {
-  node_t *current_node = t->root;
-
-  while (current_node->left != t->nil) {
-    current_node = current_node->left;
-  }
-  return current_node;
+  return t->leftmost != t->nil ? t->leftmost : NULL;
 }
 
 /*
 * @details Finds the node with the maximum key in the red-black tree (rbtree).
 * @param[in] t - A pointer to the rbtree to search in.
-* @return node_t - A pointer to the node with the maximum key.
+* @return node_t - A pointer to the node with the maximum key, or NULL if empty.
 */
 node_t *rbtree_max(const rbtree *t) {
-  node_t *current_node = t->root;
-
-  while (current_node->right != t->nil) {
-    current_node = current_node->right;
-  }
-  return current_node;
+  return t->rightmost != t->nil ? t->rightmost : NULL;
 }
 
 /*
 * @details Deletes a node with a given key from the red-black tree (rbtree).
-* @param[in] t - A pointer to the rbtree.
+*          A counted tree only drops one occurrence while more remain.
+* @param[in] t - A pointer to the rbtree; must not hold caller-owned nodes.
 * @param[in] p - A pointer to the node to delete.
-* @return int - Returns 0 on successful deletion.
+* @return int - Returns 0 on successful deletion, -1 for a tree holding
+*               nodes linked with rbtree_link() (use rbtree_unlink there).
 */
 int rbtree_erase(rbtree *t, node_t *p) {
+  // the caller's nodes are the caller's to free
+  if (t->foreign_count != 0)
+    return -1;
+  if (t->count_offset != 0 && *node_count(t, p) > 1) {
+    (*node_count(t, p))--;
+    rbtree_augment_propagate(t, p);
+    return 0;
+  }
+
+  rbtree_unlink_node(t, p);
+  rbtree_free_node(t, p);
+  return 0;
+}
+
+/*
+* @details Unlinks a node from the tree, rebalances and updates the caches.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] p - A pointer to the node to unlink.
+* @return void
+*/
+static void rbtree_unlink_node(rbtree *t, node_t *p) {
+  t->node_count--;
+
+  // neighbours keep their addresses through the unlink below
+  if (p == t->leftmost)
+    t->leftmost = rbtree_successor(t, p);
+  if (p == t->rightmost)
+    t->rightmost = rbtree_predecessor(t, p);
+  // a treap node sinks until it has at most one child, so no successor moves
+  if (t->engine == RBTREE_ENGINE_TREAP)
+    treap_sift_down(t, p);
+  rbtree_compact_forget(t, p);
+
   node_t *delete_node = p;
   node_t *new_node;
+  node_t *changed_node = p->parent;  // lowest node whose subtree loses p
   color_t delete_node_original_color = delete_node->color;
 
   if (p->left == t->nil){
@@ -179,8 +447,10 @@ int rbtree_erase(rbtree *t, node_t *p) {
     new_node = delete_node->right;
     if (delete_node->parent == p){
       new_node->parent = delete_node;
+      changed_node = delete_node;
     }
     else{
+      changed_node = delete_node->parent;
       rbtree_transplant(t, delete_node, delete_node->right);
       delete_node->right = p->right;
       delete_node->right->parent = delete_node;
@@ -190,25 +460,242 @@ int rbtree_erase(rbtree *t, node_t *p) {
     delete_node->left->parent = delete_node;
     delete_node->color = p->color;
   }
-  if (delete_node_original_color == RBTREE_BLACK){
+  // rotations in the fixup keep aggregates locally, so refresh the path first
+  rbtree_augment_propagate(t, changed_node);
+  if (t->engine == RBTREE_ENGINE_AVL)
+    avl_retrace(t, changed_node);
+  else if (t->engine == RBTREE_ENGINE_RB && delete_node_original_color == RBTREE_BLACK){
     rbtree_erase_fixup(t, new_node);
   }
-  free(p);
-  return 0;
+  if (t->index.slots != NULL)
+    index_forget(t, p);
+}
+
+/*
+* @details Removes one occurrence of the minimum key.
+*          The cached leftmost node has no left child, so the erase is a
+*          single transplant and its successor becomes the new leftmost.
+* @param[in] t - A pointer to the rbtree.
+* @param[out] key - Receives the removed key; may be NULL.
+* @return int - Returns 0 on success, -1 if the tree is empty or holds
+*               caller-owned nodes (take rbtree_min() and rbtree_unlink() it).
+*/
+int rbtree_pop_min(rbtree *t, key_t *key) {
+  if (t->leftmost == t->nil || t->foreign_count != 0)
+    return -1;
+  if (key != NULL)
+    *key = t->leftmost->key;
+  return rbtree_erase(t, t->leftmost);
+}
+
+/*
+* @details Removes one occurrence of the maximum key.
+* @param[in] t - A pointer to the rbtree.
+* @param[out] key - Receives the removed key; may be NULL.
+* @return int - Returns 0 on success, -1 if the tree is empty or holds
+*               caller-owned nodes (take rbtree_max() and rbtree_unlink() it).
+*/
+int rbtree_pop_max(rbtree *t, key_t *key) {
+  if (t->rightmost == t->nil || t->foreign_count != 0)
+    return -1;
+  if (key != NULL)
+    *key = t->rightmost->key;
+  return rbtree_erase(t, t->rightmost);
 }
 
 /*
  * @details Performs an inorder traversal of the rbtree and stores keys in an array.
+ *          Counted nodes are expanded into one entry per occurrence.
  * @param[in] t - A pointer to the rbtree.
  * @param[out] arr - A pointer to the array to store the keys.
  * @param[in] n - The maximum number of keys to store in the array.
  * @return int - Returns 0 on successful traversal.
  */
 int rbtree_to_array(const rbtree *t, key_t *arr, const size_t n) {
-  rbtree_inorder(t->root, arr, 0);
+  rbtree_inorder(t, t->root, arr, 0, n);
   return 0;
 }
 
+/*
+ * @details Steps to the next node in key order.
+ * @param[in] t - A pointer to the rbtree.
+ * @param[in] p - A pointer to a node of the tree.
+ * @return node_t - The in-order successor, or NULL after the maximum.
+ */
+node_t *rbtree_next(const rbtree *t, const node_t *p) {
+  node_t *next_node = rbtree_successor(t, (node_t *)p);
+  return next_node != t->nil ? next_node : NULL;
+}
+
+/*
+ * @details Steps to the previous node in key order.
+ * @param[in] t - A pointer to the rbtree.
+ * @param[in] p - A pointer to a node of the tree.
+ * @return node_t - The in-order predecessor, or NULL before the minimum.
+ */
+node_t *rbtree_prev(const rbtree *t, const node_t *p) {
+  node_t *prev_node = rbtree_predecessor(t, (node_t *)p);
+  return prev_node != t->nil ? prev_node : NULL;
+}
+
+/*
+ * @details Counts the occurrences of a key.
+ *          O(log n) on a counted tree, O(log n + k) otherwise.
+ * @param[in] t - A pointer to the rbtree.
+ * @param[in] key - The key value to count.
+ * @return size_t - The number of times the key was inserted and not erased.
+ */
+size_t rbtree_count(const rbtree *t, const key_t key) {
+  node_t *current_node = t->root;
+  node_t *first_node = t->nil;
+  size_t count = 0;
+
+  if (t->count_offset != 0) {
+    node_t *p = rbtree_find(t, key);
+    return p == NULL ? 0 : *node_count(t, p);
+  }
+
+  // leftmost node holding the key; duplicates may sit on either side
+  while (current_node != t->nil) {
+    if (current_node->key < key)
+      current_node = current_node->right;
+    else {
+      if (current_node->key == key)
+        first_node = current_node;
+      current_node = current_node->left;
+    }
+  }
+  for (; first_node != t->nil && first_node->key == key;
+       first_node = rbtree_successor(t, first_node))
+    count++;
+  return count;
+}
+
+/*
+ * @details Returns how many occurrences of its key a node stands for.
+ * @param[in] t - A pointer to the rbtree.
+ * @param[in] p - A pointer to a node of the tree.
+ * @return size_t - The node's multiplicity; always 1 unless the tree is counted.
+ */
+size_t rbtree_node_count(const rbtree *t, const node_t *p) {
+  return t->count_offset != 0 ? *node_count(t, p) : 1;
+}
+
+/*
+ * @details Reports how much memory the tree holds and how much of it is waste.
+ * @param[in] t - A pointer to the rbtree.
+ * @return rbtree_memory_t - Node count, live bytes, allocator overhead and slack.
+ */
+rbtree_memory_t rbtree_memory_usage(const rbtree *t) {
+  rbtree_memory_t usage;
+
+  usage.node_count = t->node_count;
+  usage.live_bytes = t->live_bytes;
+  usage.overhead_bytes = t->live_blocks * t->allocator.block_overhead;
+  usage.slack_bytes = t->usable_bytes - t->live_bytes;
+  if (t->index.slots != NULL)
+    usage.slack_bytes += (t->index.mask + 1 - t->index.used) * sizeof(rbtree_index_slot_t);
+  for (size_t i = 0; i < t->narenas; i++)
+    usage.slack_bytes += (t->arenas[i]->capacity - t->arenas[i]->live) * t->node_size;
+  return usage;
+}
+
+/*
+* @details Moves every node into one contiguous block laid out for locality.
+*          Node pointers held by the caller are invalidated.
+* @param[in] t - A pointer to the rbtree; must not hold caller-owned nodes.
+* @param[in] layout - RBTREE_LAYOUT_INORDER for scans, RBTREE_LAYOUT_VEB for descents.
+* @return int - Returns 0 on success, -1 if the tree holds caller-owned nodes.
+*/
+int rbtree_compact(rbtree *t, const rbtree_layout_t layout) {
+  // a pending plan may have passed over nodes inserted behind it
+  if (t->foreign_count == 0)
+    rbtree_compact_abort(t);
+  return rbtree_compact_step(t, layout, (size_t)-1) < 0 ? -1 : 0;
+}
+
+/*
+* @details Runs a bounded slice of a compaction.
+*          Each slice moves at most budget nodes into a block of its own, in
+*          O(budget log n). The plan resumes from where the last slice stopped,
+*          so inserts and erases in between do not cancel it; nodes inserted
+*          behind it wait for the next compaction. Nodes only ever move inside
+*          this call; a new compaction first empties blocks under a quarter full.
+* @param[in] t - A pointer to the rbtree; must not hold caller-owned nodes.
+* @param[in] layout - The target layout; a different one restarts the plan.
+* @param[in] budget - The maximum number of nodes to move in this slice.
+* @return int - Returns 1 when finished, 0 if more slices are needed, -1 if refused.
+*/
+int rbtree_compact_step(rbtree *t, const rbtree_layout_t layout, const size_t budget) {
+  // caller-owned nodes cannot be moved behind the caller's back
+  if (t->foreign_count != 0)
+    return -1;
+  if (t->compaction != NULL && t->compaction->layout != layout)
+    rbtree_compact_abort(t);
+  if (t->compaction == NULL) {
+    if (t->node_count == 0)
+      return 1;
+    rbtree_compact_begin(t, layout);
+  }
+
+  struct rbtree_compaction *c = t->compaction;
+  const size_t capacity = budget < t->node_count ? budget : t->node_count;
+  struct rbtree_arena *a = NULL;
+  size_t moved = 0;
+  int done = 0;
+
+  while (moved < capacity) {
+    node_t *from = rbtree_compact_next(t, c);
+    if (from == NULL) {
+      done = 1;
+      break;
+    }
+    if (a == NULL)
+      a = arena_new(t, capacity);
+    node_t *to = (node_t *)(a->base + moved++ * t->node_size);
+    rbtree_relocate(t, from, to);
+    rbtree_compact_moved(c, from, to);
+  }
+  // the slots the plan ran out before filling take later inserts
+  for (size_t i = capacity; a != NULL && i-- > moved;)
+    rbtree_free_node(t, (node_t *)(a->base + i * t->node_size));
+  if (!done)
+    return 0;
+  rbtree_compact_abort(t);
+  return 1;
+}
+
+/*
+ * @details Aggregates the keys in [lo, hi] in key order with the tree's monoid.
+ * @param[in] t - A pointer to an augmented rbtree.
+ * @param[in] lo - Lower bound of the key range (inclusive).
+ * @param[in] hi - Upper bound of the key range (inclusive).
+ * @return agg_t - The combined value, or the identity if the range is empty.
+ */
+agg_t rbtree_aggregate(const rbtree *t, const key_t lo, const key_t hi) {
+  const rbtree_monoid_t *m = &t->augment;
+  node_t *split_node = t->root;
+
+  if (m->combine == NULL)
+    return m->identity;
+
+  // walk down to the first node inside the range; both bounds split there
+  while (split_node != t->nil) {
+    if (split_node->key < lo)
+      split_node = split_node->right;
+    else if (split_node->key > hi)
+      split_node = split_node->left;
+    else
+      break;
+  }
+  if (split_node == t->nil)
+    return m->identity;
+
+  return m->combine(m->combine(rbtree_aggregate_from(t, split_node->left, lo),
+                               rbtree_node_value(t, split_node)),
+                    rbtree_aggregate_to(t, split_node->right, hi));
+}
+
 /* 
 * @details  Binary search tree insert function
 * @param[in]  rbtree_struct_pointer Red-Black Tree being inserted into.
@@ -309,6 +796,7 @@ void *rbtree_insert_fixup(rbtree *t, node_t *current_node) {
 * @return  void
 */
 void *rbtree_rotate(rbtree *t, node_t *current_node, const rotate_dir_t rotate_dir) {
+  t->rotations++;
   if (rotate_dir == ROTATE_LEFT) {
     // set right node
     node_t *right_node = current_node->right; 
@@ -334,6 +822,12 @@ void *rbtree_rotate(rbtree *t, node_t *current_node, const rotate_dir_t rotate_d
     // reconnect current node <-> right node
     right_node->left = current_node;
     current_node->parent = right_node;
+
+    // current node is now below right node; refresh bottom-up
+    if (t->augment.combine != NULL) {
+      rbtree_augment_update(t, current_node);
+      rbtree_augment_update(t, right_node);
+    }
   }
 
   else if (rotate_dir == ROTATE_RIGHT){
@@ -361,6 +855,11 @@ void *rbtree_rotate(rbtree *t, node_t *current_node, const rotate_dir_t rotate_d
     // reconnect current node <-> right node
     left_node->right = current_node;
     current_node->parent = left_node;
+
+    if (t->augment.combine != NULL) {
+      rbtree_augment_update(t, current_node);
+      rbtree_augment_update(t, left_node);
+    }
   }
 }
 
@@ -470,19 +969,869 @@ void *rbtree_transplant(rbtree *t, node_t *delete_node, node_t *new_node){
 
 /*
 * @details Performs an inorder traversal of the rbtree and stores the keys in an array.
+* @param[in] t - A pointer to the rbtree.
 * @param[in] root - A pointer to the root node of the subtree to traverse.
 * @param[out] arr - A pointer to the array for storing the keys.
 * @param[in] i - The current index in the array.
+* @param[in] n - The size of the array; traversal stops once it is full.
 * @return The updated index in the array after storing the keys.
 */
-int rbtree_inorder(node_t *root, key_t *arr, int i) {
-    if (root != NULL) {
-        i = rbtree_inorder(root->left, arr, i);
-        if(root->right != NULL && root->left != NULL){
+size_t rbtree_inorder(const rbtree *t, node_t *root, key_t *arr, size_t i, const size_t n) {
+    if (root != t->nil && i < n) {
+        i = rbtree_inorder(t, root->left, arr, i, n);
+        for (size_t c = rbtree_node_count(t, root); c > 0 && i < n; c--) {
           arr[i] = root->key;
           i++;
         }
-        i = rbtree_inorder(root->right, arr, i);
+        i = rbtree_inorder(t, root->right, arr, i, n);
     }
     return i;
-}
\ No newline at end of file
+}
+
+/*
+* @details Returns the aggregate slot stored behind a node of an augmented tree.
+* @param[in] n - A pointer to the node.
+* @return agg_t * - A pointer to the node's subtree aggregate.
+*/
+static agg_t *node_agg(const node_t *n) {
+  return &((rbtree_aug_node_t *)n)->agg;
+}
+
+/*
+* @details Returns the multiplicity slot stored behind a node of a counted tree.
+* @param[in] t - A pointer to a counted rbtree.
+* @param[in] n - A pointer to the node.
+* @return size_t * - A pointer to the node's multiplicity.
+*/
+static size_t *node_count(const rbtree *t, const node_t *n) {
+  return (size_t *)((char *)n + t->count_offset);
+}
+
+/*
+* @details Lifts a node's own occurrences into the monoid.
+*          A multiplicity of c costs O(log c) combines by repeated doubling.
+* @param[in] t - A pointer to an augmented rbtree.
+* @param[in] n - A pointer to the node.
+* @return agg_t - lift(key) combined with itself once per occurrence.
+*/
+static agg_t rbtree_node_value(const rbtree *t, const node_t *n) {
+  const rbtree_monoid_t *m = &t->augment;
+  agg_t value = m->lift(n->key);
+  agg_t acc = m->identity;
+  size_t c = rbtree_node_count(t, n);
+
+  if (c == 1)
+    return value;
+  while (c > 0) {
+    if (c & 1)
+      acc = m->combine(acc, value);
+    value = m->combine(value, value);
+    c >>= 1;
+  }
+  return acc;
+}
+
+/*
+* @details Finds the in-order successor of a node.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] n - A pointer to a node of the tree.
+* @return node_t - The next node in key order, or the sentinel after the last one.
+*/
+static node_t *rbtree_successor(const rbtree *t, node_t *n) {
+  if (n->right != t->nil) {
+    n = n->right;
+    while (n->left != t->nil)
+      n = n->left;
+    return n;
+  }
+  while (n->parent != t->nil && n == n->parent->right)
+    n = n->parent;
+  return n->parent;
+}
+
+/*
+* @details Finds the in-order predecessor of a node.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] n - A pointer to a node of the tree.
+* @return node_t - The previous node in key order, or the sentinel before the first one.
+*/
+static node_t *rbtree_predecessor(const rbtree *t, node_t *n) {
+  if (n->left != t->nil) {
+    n = n->left;
+    while (n->right != t->nil)
+      n = n->right;
+    return n;
+  }
+  while (n->parent != t->nil && n == n->parent->left)
+    n = n->parent;
+  return n->parent;
+}
+
+/*
+* @details Recomputes a node's aggregate from its children's aggregates.
+* @param[in] t - A pointer to an augmented rbtree.
+* @param[in] n - A pointer to the node to refresh (not the sentinel).
+* @return void
+*/
+static void rbtree_augment_update(const rbtree *t, node_t *n) {
+  const rbtree_monoid_t *m = &t->augment;
+  *node_agg(n) = m->combine(m->combine(*node_agg(n->left), rbtree_node_value(t, n)),
+                            *node_agg(n->right));
+}
+
+/*
+* @details Refreshes aggregates from a node up to the root.
+* @param[in] t - A pointer to the rbtree; does nothing if it is not augmented.
+* @param[in] n - A pointer to the lowest node whose subtree changed.
+* @return void
+*/
+static void rbtree_augment_propagate(const rbtree *t, node_t *n) {
+  if (t->augment.combine == NULL)
+    return;
+  while (n != t->nil) {
+    rbtree_augment_update(t, n);
+    n = n->parent;
+  }
+}
+
+/*
+* @details Aggregates the keys >= lo in a subtree, in key order.
+* @param[in] t - A pointer to an augmented rbtree.
+* @param[in] n - A pointer to the subtree root.
+* @param[in] lo - Lower bound of the key range (inclusive).
+* @return agg_t - The combined value of the matching keys.
+*/
+static agg_t rbtree_aggregate_from(const rbtree *t, node_t *n, const key_t lo) {
+  const rbtree_monoid_t *m = &t->augment;
+  agg_t suffix = m->identity;
+
+  // every included piece lies left of what was collected before it
+  while (n != t->nil) {
+    if (n->key >= lo) {
+      suffix = m->combine(m->combine(rbtree_node_value(t, n), *node_agg(n->right)), suffix);
+      n = n->left;
+    }
+    else
+      n = n->right;
+  }
+  return suffix;
+}
+
+/*
+* @details Aggregates the keys <= hi in a subtree, in key order.
+* @param[in] t - A pointer to an augmented rbtree.
+* @param[in] n - A pointer to the subtree root.
+* @param[in] hi - Upper bound of the key range (inclusive).
+* @return agg_t - The combined value of the matching keys.
+*/
+static agg_t rbtree_aggregate_to(const rbtree *t, node_t *n, const key_t hi) {
+  const rbtree_monoid_t *m = &t->augment;
+  agg_t prefix = m->identity;
+
+  while (n != t->nil) {
+    if (n->key <= hi) {
+      prefix = m->combine(prefix, m->combine(*node_agg(n->left), rbtree_node_value(t, n)));
+      n = n->right;
+    }
+    else
+      n = n->left;
+  }
+  return prefix;
+}
+
+/*
+* @details Returns the slot where probing for a key starts.
+* @param[in] index - A pointer to the hash index.
+* @param[in] key - The key to hash.
+* @return size_t - The home slot of the key.
+*/
+static size_t index_home(const rbtree_index_t *index, const key_t key) {
+  // Fibonacci hashing; the high half mixes every key bit
+  uint64_t h = (uint64_t)(uint32_t)key * 0x9E3779B97F4A7C15ull;
+  return (size_t)(h >> 32) & index->mask;
+}
+
+/*
+* @details Looks a key up in the hash index.
+* @param[in] index - A pointer to the hash index.
+* @param[in] key - The key to look for.
+* @return node_t - A node holding the key, or NULL if there is none.
+*/
+static node_t *index_lookup(const rbtree_index_t *index, const key_t key) {
+  size_t i = index_home(index, key);
+
+  while (index->slots[i].node != NULL) {
+    if (index->slots[i].key == key)
+      return index->slots[i].node;
+    i = (i + 1) & index->mask;
+  }
+  return NULL;
+}
+
+/*
+* @details Records a node in the hash index unless its key is already present.
+* @param[in] t - A pointer to the rbtree owning the index.
+* @param[in] n - A pointer to the node to record.
+* @return void
+*/
+static void index_add(rbtree *t, node_t *n) {
+  rbtree_index_t *index = &t->index;
+
+  // keep the load factor at or below 1/2 so probe runs stay short
+  if ((index->used + 1) * 2 > index->mask + 1)
+    index_resize(t, (index->mask + 1) * 2);
+
+  size_t i = index_home(index, n->key);
+  while (index->slots[i].node != NULL) {
+    if (index->slots[i].key == n->key)
+      return;
+    i = (i + 1) & index->mask;
+  }
+  index->slots[i].key = n->key;
+  index->slots[i].node = n;
+  index->used++;
+}
+
+/*
+* @details Drops an unlinked node from the hash index.
+*          If other nodes still hold the key, one of them takes over the slot.
+* @param[in] t - A pointer to the rbtree the node was unlinked from.
+* @param[in] n - A pointer to the unlinked node.
+* @return void
+*/
+static void index_forget(rbtree *t, node_t *n) {
+  rbtree_index_t *index = &t->index;
+  size_t i = index_home(index, n->key);
+
+  while (index->slots[i].node != n) {
+    if (index->slots[i].node == NULL)
+      return;  // a duplicate owns the slot
+    i = (i + 1) & index->mask;
+  }
+
+  // hand the slot over to a remaining duplicate, if any
+  node_t *same_node = t->root;
+  while (same_node != t->nil && same_node->key != n->key)
+    same_node = same_node->key < n->key ? same_node->right : same_node->left;
+  if (same_node != t->nil) {
+    index->slots[i].node = same_node;
+    return;
+  }
+
+  // backward-shift deletion: pull later entries of the run into the hole
+  size_t hole = i;
+  index->slots[hole].node = NULL;
+  index->used--;
+  for (i = (hole + 1) & index->mask; index->slots[i].node != NULL;
+       i = (i + 1) & index->mask) {
+    size_t home = index_home(index, index->slots[i].key);
+    if (((i - home) & index->mask) >= ((i - hole) & index->mask)) {
+      index->slots[hole] = index->slots[i];
+      index->slots[i].node = NULL;
+      hole = i;
+    }
+  }
+}
+
+/*
+* @details Rehashes the index into a table of the given capacity.
+* @param[in] t - A pointer to the rbtree owning the index.
+* @param[in] capacity - The new capacity, a power of two.
+* @return void
+*/
+static void index_resize(rbtree *t, const size_t capacity) {
+  rbtree_index_t *index = &t->index;
+  rbtree_index_slot_t *old_slots = index->slots;
+  const size_t old_capacity = old_slots != NULL ? index->mask + 1 : 0;
+
+  index->slots = (rbtree_index_slot_t *)rbtree_alloc(t, capacity * sizeof(rbtree_index_slot_t));
+  index->mask = capacity - 1;
+  index->used = 0;
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old_slots[i].node != NULL)
+      index_add(t, old_slots[i].node);
+  }
+  if (old_slots != NULL)
+    rbtree_free(t, old_slots, old_capacity * sizeof(rbtree_index_slot_t));
+}
+
+/*
+* @details Allocates zeroed memory through the tree's allocator and accounts for it.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] size - The number of bytes to allocate.
+* @return void * - The zeroed block.
+*/
+static void *rbtree_alloc(rbtree *t, const size_t size) {
+  void *ptr = t->allocator.alloc(t->allocator.ctx, size);
+
+  memset(ptr, 0, size);
+  rbtree_account(t, ptr, size, 1);
+  return ptr;
+}
+
+/*
+* @details Returns memory to the tree's allocator and accounts for it.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] ptr - The block to free.
+* @param[in] size - The size it was allocated with.
+* @return void
+*/
+static void rbtree_free(rbtree *t, void *ptr, const size_t size) {
+  rbtree_account(t, ptr, size, -1);
+  t->allocator.free(t->allocator.ctx, ptr, size);
+}
+
+/*
+* @details Adds or removes a block from the tree's memory counters.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] ptr - The block, still allocated.
+* @param[in] size - The size it was allocated with.
+* @param[in] sign - 1 for a new block, -1 for one about to be freed.
+* @return void
+*/
+static void rbtree_account(rbtree *t, const void *ptr, const size_t size, const int sign) {
+  const size_t usable = t->allocator.usable_size != NULL
+                            ? t->allocator.usable_size(t->allocator.ctx, ptr)
+                            : size;
+
+  if (sign > 0) {
+    t->live_bytes += size;
+    t->usable_bytes += usable;
+    t->live_blocks++;
+  }
+  else {
+    t->live_bytes -= size;
+    t->usable_bytes -= usable;
+    t->live_blocks--;
+  }
+}
+
+/*
+* @details Frees every node of a subtree in post-order.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] n - A pointer to the subtree root.
+* @return void
+*/
+static void rbtree_free_subtree(rbtree *t, node_t *n) {
+  if (n == t->nil)
+    return;
+  rbtree_free_subtree(t, n->left);
+  rbtree_free_subtree(t, n->right);
+  rbtree_free_node(t, n);
+}
+
+/*
+* @details Allocates a node for the tree, refilling a free arena slot if any.
+* @param[in] t - A pointer to the rbtree.
+* @return node_t - A zeroed node of t->node_size bytes.
+*/
+static node_t *rbtree_alloc_node(rbtree *t) {
+  struct rbtree_arena *a = t->reuse;
+
+  if (a == NULL)
+    return (node_t *)rbtree_alloc(t, t->node_size);
+
+  node_t *n = a->free;
+  const size_t slot = ((char *)n - a->base) / t->node_size;
+  a->free = n->left;
+  if (a->free == NULL)
+    arena_unreuse(t, a);
+  a->used[slot / 8] |= 1u << slot % 8;
+  a->live++;
+  memset(n, 0, t->node_size);
+  return n;
+}
+
+/*
+* @details Frees a tree-owned node, whether it came from the allocator or an arena.
+*          An arena slot waits for the next insert; the arena goes back to the
+*          allocator once its last node is gone.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] n - A pointer to the unlinked node.
+* @return void
+*/
+static void rbtree_free_node(rbtree *t, node_t *n) {
+  const size_t i = arena_find(t, n);
+
+  if (i == t->narenas) {
+    rbtree_free(t, n, t->node_size);
+    return;
+  }
+
+  struct rbtree_arena *a = t->arenas[i];
+  const size_t slot = ((char *)n - a->base) / t->node_size;
+  a->used[slot / 8] &= ~(1u << slot % 8);
+  a->live--;
+  if (a->live == 0) {
+    if (a->free != NULL)
+      arena_unreuse(t, a);
+    arena_remove(t, i);
+    return;
+  }
+  if (a->free == NULL) {
+    a->prev = NULL;
+    a->next = t->reuse;
+    if (t->reuse != NULL)
+      t->reuse->prev = a;
+    t->reuse = a;
+  }
+  n->left = a->free;
+  a->free = n;
+}
+
+/*
+* @details Finds the arena holding a node by binary search over the addresses.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] n - A pointer to a node.
+* @return size_t - The arena's position in t->arenas, or t->narenas if none.
+*/
+static size_t arena_find(const rbtree *t, const node_t *n) {
+  size_t lo = 0, hi = t->narenas;
+
+  // first arena starting above n; the one before it may contain n
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    if ((const char *)n < t->arenas[mid]->base)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  if (lo == 0)
+    return t->narenas;
+  const struct rbtree_arena *a = t->arenas[lo - 1];
+  if ((const char *)n < a->base + a->capacity * t->node_size)
+    return lo - 1;
+  return t->narenas;
+}
+
+/*
+* @details Allocates an arena and records it, every slot counted as live.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] capacity - The number of slots; the caller fills or frees each one.
+* @return struct rbtree_arena - The new arena.
+*/
+static struct rbtree_arena *arena_new(rbtree *t, const size_t capacity) {
+  struct rbtree_arena *a = (struct rbtree_arena *)rbtree_alloc(
+      t, sizeof(struct rbtree_arena) + (capacity + 7) / 8);
+
+  a->base = (char *)rbtree_alloc(t, capacity * t->node_size);
+  a->capacity = capacity;
+  a->live = capacity;
+  a->free = NULL;
+  memset(a->used, 0xff, (capacity + 7) / 8);
+
+  if (t->narenas == t->arenas_capacity) {
+    const size_t cap = t->arenas_capacity ? 2 * t->arenas_capacity : 4;
+    struct rbtree_arena **arenas =
+        (struct rbtree_arena **)rbtree_alloc(t, cap * sizeof(struct rbtree_arena *));
+    if (t->arenas != NULL) {
+      memcpy(arenas, t->arenas, t->narenas * sizeof(struct rbtree_arena *));
+      rbtree_free(t, t->arenas, t->arenas_capacity * sizeof(struct rbtree_arena *));
+    }
+    t->arenas = arenas;
+    t->arenas_capacity = cap;
+  }
+
+  // keep the table sorted by address
+  size_t i = t->narenas;
+  while (i > 0 && t->arenas[i - 1]->base > a->base) {
+    t->arenas[i] = t->arenas[i - 1];
+    i--;
+  }
+  t->arenas[i] = a;
+  t->narenas++;
+  return a;
+}
+
+/*
+* @details Drops an empty arena from the table and frees it.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] i - The arena's position in t->arenas.
+* @return void
+*/
+static void arena_remove(rbtree *t, const size_t i) {
+  struct rbtree_arena *a = t->arenas[i];
+
+  memmove(t->arenas + i, t->arenas + i + 1,
+          (t->narenas - i - 1) * sizeof(struct rbtree_arena *));
+  t->narenas--;
+  rbtree_free(t, a->base, a->capacity * t->node_size);
+  rbtree_free(t, a, sizeof(struct rbtree_arena) + (a->capacity + 7) / 8);
+}
+
+/*
+* @details Takes an arena off the list of those with free slots.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] a - A pointer to an arena on t->reuse.
+* @return void
+*/
+static void arena_unreuse(rbtree *t, struct rbtree_arena *a) {
+  if (a->prev != NULL)
+    a->prev->next = a->next;
+  else
+    t->reuse = a->next;
+  if (a->next != NULL)
+    a->next->prev = a->prev;
+}
+
+/*
+* @details Moves the nodes of every sparse arena into single allocations,
+*          which frees the arena. Each move is paid for by the three or more
+*          frees that made the arena sparse. Only a new compaction calls this,
+*          so nodes never move under an insert or erase.
+* @param[in] t - A pointer to the rbtree.
+* @return void
+*/
+static void rbtree_arena_evacuate(rbtree *t) {
+  // the arena leaves the table with its last node, so walk backwards
+  for (size_t i = t->narenas; i-- > 0;) {
+    struct rbtree_arena *a = t->arenas[i];
+    if (!ARENA_SPARSE(a))
+      continue;
+    char *base = a->base;
+    size_t left = a->live;
+    for (size_t slot = 0; left > 0; slot++) {
+      if (a->used[slot / 8] >> slot % 8 & 1) {
+        left--;
+        // the last move frees a; the loop ends before touching it again
+        rbtree_relocate(t, (node_t *)(base + slot * t->node_size),
+                        (node_t *)rbtree_alloc(t, t->node_size));
+      }
+    }
+  }
+}
+
+static void *libc_alloc(void *ctx, const size_t size) {
+  return malloc(size);
+}
+
+static void libc_free(void *ctx, void *ptr, const size_t size) {
+  free(ptr);
+}
+
+#ifdef __GLIBC__
+static size_t libc_usable_size(void *ctx, const void *ptr) {
+  return malloc_usable_size((void *)ptr);
+}
+#endif
+
+/*
+* @details Starts a compaction: empties sparse arenas, then sets the plan
+*          at the first node in key order or at the root's van Emde Boas layout.
+* @param[in] t - A pointer to a non-empty rbtree.
+* @param[in] layout - The target layout.
+* @return void
+*/
+static void rbtree_compact_begin(rbtree *t, const rbtree_layout_t layout) {
+  rbtree_arena_evacuate(t);
+
+  struct rbtree_compaction *c =
+      (struct rbtree_compaction *)rbtree_alloc(t, sizeof(struct rbtree_compaction));
+  c->layout = layout;
+  c->cursor = t->nil;
+  t->compaction = c;
+  if (layout == RBTREE_LAYOUT_VEB) {
+    c->height = veb_levels(t);
+    veb_push(t, c, t->root, 0, 0, c->height);
+  }
+}
+
+/*
+* @details Drops an in-progress compaction plan, if any.
+* @param[in] t - A pointer to the rbtree.
+* @return void
+*/
+static void rbtree_compact_abort(rbtree *t) {
+  struct rbtree_compaction *c = t->compaction;
+
+  if (c == NULL)
+    return;
+  t->compaction = NULL;
+  if (c->frames != NULL)
+    rbtree_free(t, c->frames, c->frames_capacity * sizeof(struct veb_frame));
+  rbtree_free(t, c, sizeof(struct rbtree_compaction));
+}
+
+/*
+* @details Advances the plan to the next node to move.
+*          In-order takes the cursor's successor. vEB unfolds pending pieces
+*          until one is a single level, which is the node itself.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] c - A pointer to the tree's compaction.
+* @return node_t - The next node to move, or NULL when the plan is done.
+*/
+static node_t *rbtree_compact_next(rbtree *t, struct rbtree_compaction *c) {
+  if (c->layout != RBTREE_LAYOUT_VEB) {
+    node_t *n = c->cursor == t->nil ? t->leftmost : rbtree_successor(t, c->cursor);
+    return n != t->nil ? n : NULL;
+  }
+
+  while (c->nframes > 0) {
+    const struct veb_frame f = c->frames[--c->nframes];
+    if (f.node == t->nil)
+      continue;
+    // pushed right first so the left side comes out first
+    if (f.skip > 0) {
+      veb_push(t, c, f.node->right, f.depth + 1, f.skip - 1, f.levels);
+      veb_push(t, c, f.node->left, f.depth + 1, f.skip - 1, f.levels);
+      continue;
+    }
+    if (f.levels > 1) {
+      const int bottom = f.levels / 2;
+      veb_push(t, c, f.node, f.depth, f.levels - bottom, bottom);
+      veb_push(t, c, f.node, f.depth, 0, f.levels - bottom);
+      continue;
+    }
+    // below the planned height no lower piece covers the children
+    if (f.depth + 1 >= c->height) {
+      veb_push(t, c, f.node->right, f.depth + 1, 0, 1);
+      veb_push(t, c, f.node->left, f.depth + 1, 0, 1);
+    }
+    return f.node;
+  }
+  return NULL;
+}
+
+/*
+* @details Points the plan at a node's new address after a move.
+* @param[in] c - A pointer to the tree's compaction.
+* @param[in] from - The node's old address.
+* @param[in] to - The node's new address.
+* @return void
+*/
+static void rbtree_compact_moved(struct rbtree_compaction *c, node_t *from, node_t *to) {
+  c->cursor = to;
+  // pieces still to unfold below the node name it by address
+  for (size_t i = 0; i < c->nframes; i++) {
+    if (c->frames[i].node == from)
+      c->frames[i].node = to;
+  }
+}
+
+/*
+* @details Keeps the plan off a node about to be unlinked: the cursor steps
+*          back to its predecessor, and pending pieces rooted at it take the
+*          node that will stand in its place.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] p - A pointer to the node being unlinked.
+* @return void
+*/
+static void rbtree_compact_forget(rbtree *t, node_t *p) {
+  struct rbtree_compaction *c = t->compaction;
+
+  if (c == NULL)
+    return;
+  if (c->cursor == p)
+    c->cursor = rbtree_predecessor(t, p);
+
+  node_t *heir = p->left == t->nil ? p->right : p->left;
+  if (p->left != t->nil && p->right != t->nil) {
+    heir = p->right;
+    while (heir->left != t->nil)
+      heir = heir->left;
+  }
+  for (size_t i = 0; i < c->nframes; i++) {
+    if (c->frames[i].node == p)
+      c->frames[i].node = heir;
+  }
+}
+
+/*
+* @details Pushes a pending piece of a van Emde Boas layout.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] c - A pointer to the tree's compaction.
+* @param[in] n - A pointer to the piece's node.
+* @param[in] depth - The node's depth.
+* @param[in] skip - How far below n the pieces to lay out start.
+* @param[in] levels - The number of levels of each piece.
+* @return void
+*/
+static void veb_push(rbtree *t, struct rbtree_compaction *c, node_t *n,
+                     const int depth, const int skip, const int levels) {
+  if (n == t->nil)
+    return;
+  if (c->nframes == c->frames_capacity) {
+    const size_t cap = c->frames_capacity ? 2 * c->frames_capacity : 64;
+    struct veb_frame *frames =
+        (struct veb_frame *)rbtree_alloc(t, cap * sizeof(struct veb_frame));
+    if (c->frames != NULL) {
+      memcpy(frames, c->frames, c->nframes * sizeof(struct veb_frame));
+      rbtree_free(t, c->frames, c->frames_capacity * sizeof(struct veb_frame));
+    }
+    c->frames = frames;
+    c->frames_capacity = cap;
+  }
+  c->frames[c->nframes++] = (struct veb_frame){n, depth, skip, levels};
+}
+
+/*
+* @details Bounds the tree's height without visiting every node.
+*          AVL keeps it in the root; a red-black tree is at most twice its
+*          black height; a treap gets twice the balanced height, and the
+*          rare deeper nodes follow their ancestors in preorder.
+* @param[in] t - A pointer to a non-empty rbtree.
+* @return int - The number of levels to plan for.
+*/
+static int veb_levels(const rbtree *t) {
+  int levels = 0;
+
+  if (t->engine == RBTREE_ENGINE_AVL)
+    return t->root->height;
+  if (t->engine == RBTREE_ENGINE_RB) {
+    for (const node_t *p = t->root; p != t->nil; p = p->left)
+      levels += p->color == RBTREE_BLACK;
+    return 2 * levels;
+  }
+  for (size_t n = t->node_count; n > 0; n >>= 1)
+    levels++;
+  return 2 * levels;
+}
+
+/*
+* @details Moves a linked node to a new address and repoints everything at it.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] from - A pointer to the linked node; it is freed.
+* @param[in] to - A pointer to the destination slot.
+* @return void
+*/
+static void rbtree_relocate(rbtree *t, node_t *from, node_t *to) {
+  memcpy(to, from, t->node_size);
+
+  if (from->parent == t->nil)
+    t->root = to;
+  else if (from->parent->left == from)
+    from->parent->left = to;
+  else
+    from->parent->right = to;
+  if (from->left != t->nil)
+    from->left->parent = to;
+  if (from->right != t->nil)
+    from->right->parent = to;
+  if (t->nil->parent == from)
+    t->nil->parent = to;
+
+  if (t->leftmost == from)
+    t->leftmost = to;
+  if (t->rightmost == from)
+    t->rightmost = to;
+  if (t->index.slots != NULL) {
+    size_t i = index_home(&t->index, from->key);
+    while (t->index.slots[i].node != NULL) {
+      if (t->index.slots[i].node == from) {
+        t->index.slots[i].node = to;
+        break;
+      }
+      i = (i + 1) & t->index.mask;
+    }
+  }
+  rbtree_free_node(t, from);
+}
+
+/*
+* @details Recomputes an AVL node's height from its children.
+* @param[in] n - A pointer to a non-sentinel node.
+* @return void
+*/
+static void avl_update_height(node_t *n) {
+  const int l = n->left->height;
+  const int r = n->right->height;
+  n->height = 1 + (l > r ? l : r);
+}
+
+/*
+* @details Restores the AVL balance of a node whose children are balanced.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] n - A pointer to the node; its height must be current.
+* @return node_t - The node now at the top of n's old subtree.
+*/
+static node_t *avl_rebalance(rbtree *t, node_t *n) {
+  const int balance = n->left->height - n->right->height;
+
+  if (balance > 1) {
+    // left-right case: straighten the zig-zag first
+    if (n->left->right->height > n->left->left->height) {
+      node_t *left_node = n->left;
+      rbtree_rotate(t, left_node, ROTATE_LEFT);
+      avl_update_height(left_node);
+      avl_update_height(left_node->parent);
+    }
+    rbtree_rotate(t, n, ROTATE_RIGHT);
+  }
+  else if (balance < -1) {
+    if (n->right->left->height > n->right->right->height) {
+      node_t *right_node = n->right;
+      rbtree_rotate(t, right_node, ROTATE_RIGHT);
+      avl_update_height(right_node);
+      avl_update_height(right_node->parent);
+    }
+    rbtree_rotate(t, n, ROTATE_LEFT);
+  }
+  else
+    return n;
+
+  avl_update_height(n);
+  avl_update_height(n->parent);
+  return n->parent;
+}
+
+/*
+* @details Walks up from the lowest changed node, fixing heights and balance.
+*          Stops as soon as a subtree keeps its old height.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] n - A pointer to the lowest node whose subtree changed.
+* @return void
+*/
+static void avl_retrace(rbtree *t, node_t *n) {
+  while (n != t->nil) {
+    const int old_height = n->height;
+    avl_update_height(n);
+    n = avl_rebalance(t, n);
+    if (n->height == old_height)
+      break;
+    n = n->parent;
+  }
+}
+
+/*
+* @details Draws the next treap priority (xorshift32).
+* @param[in] t - A pointer to the rbtree.
+* @return unsigned - A pseudo-random priority.
+*/
+static unsigned treap_priority(rbtree *t) {
+  unsigned x = t->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return t->seed = x;
+}
+
+/*
+* @details Rotates a freshly linked treap node up until its parent outranks it.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] n - A pointer to the new leaf.
+* @return void
+*/
+static void treap_sift_up(rbtree *t, node_t *n) {
+  while (n->parent != t->nil && n->parent->priority < n->priority) {
+    if (n == n->parent->left)
+      rbtree_rotate(t, n->parent, ROTATE_RIGHT);
+    else
+      rbtree_rotate(t, n->parent, ROTATE_LEFT);
+  }
+}
+
+/*
+* @details Rotates a treap node down below its higher-priority children
+*          until it has at most one child.
+* @param[in] t - A pointer to the rbtree.
+* @param[in] n - A pointer to the node about to be unlinked.
+* @return void
+*/
+static void treap_sift_down(rbtree *t, node_t *n) {
+  while (n->left != t->nil && n->right != t->nil) {
+    if (n->left->priority > n->right->priority)
+      rbtree_rotate(t, n, ROTATE_RIGHT);
+    else
+      rbtree_rotate(t, n, ROTATE_LEFT);
+  }
+}
@@ -7,18 +7,100 @@ typedef enum { RBTREE_RED, RBTREE_BLACK } color_t;
 
 typedef int key_t;
 
+// value type of the subtree aggregate (see rbtree_monoid_t)
+typedef long long agg_t;
+
+// balancing scheme behind the rbtree API; all of them support every option
+typedef enum {
+  RBTREE_ENGINE_RB,     // red-black: at most 2 rotations per insert, 3 per erase
+  RBTREE_ENGINE_AVL,    // AVL: shallower than red-black, more rotations
+  RBTREE_ENGINE_TREAP,  // treap: random priorities, balanced in expectation
+} rbtree_engine_t;
+
 typedef struct node_t {
-  color_t color;
+  union {  // per-node balance state of the tree's engine
+    color_t color;      // RBTREE_ENGINE_RB
+    int height;         // RBTREE_ENGINE_AVL, 0 for the sentinel
+    unsigned priority;  // RBTREE_ENGINE_TREAP, a max-heap
+  };
   key_t key;
   struct node_t *parent, *left, *right;
 } node_t;
 
+// node layout of an augmented tree: the aggregate trails the links
+typedef struct {
+  node_t node;
+  agg_t agg;
+} rbtree_aug_node_t;
+
+// combine must be associative with identity as its neutral element
+typedef struct {
+  agg_t identity;
+  agg_t (*lift)(const key_t);
+  agg_t (*combine)(const agg_t, const agg_t);
+} rbtree_monoid_t;
+
+// pluggable allocator for everything a tree allocates
+typedef struct {
+  void *(*alloc)(void *ctx, const size_t size);
+  void (*free)(void *ctx, void *ptr, const size_t size);
+  size_t (*usable_size)(void *ctx, const void *ptr);  // optional
+  size_t block_overhead;  // bookkeeping bytes the allocator adds per block
+  void *ctx;
+} rbtree_allocator_t;
+
+typedef struct {
+  size_t node_count;      // linked nodes, caller-owned ones included
+  size_t live_bytes;      // bytes requested from the allocator, not yet freed
+  size_t overhead_bytes;  // allocator bookkeeping for those blocks
+  size_t slack_bytes;     // usable bytes beyond the requests + empty index slots
+} rbtree_memory_t;
+
+typedef struct {
+  const rbtree_monoid_t *augment;  // NULL: no subtree aggregate
+  int counted;  // nonzero: duplicates share one node with a multiplicity
+  int hash_index;  // nonzero: exact-match lookups go through a hash index
+  const rbtree_allocator_t *allocator;  // NULL: libc malloc/free
+  rbtree_engine_t engine;  // 0: red-black
+} rbtree_opts_t;
+
+// open-addressing key -> node index kept beside the tree
+typedef struct {
+  key_t key;
+  node_t *node;  // NULL for an empty slot
+} rbtree_index_slot_t;
+
+typedef struct {
+  rbtree_index_slot_t *slots;  // NULL when the index is disabled
+  size_t mask;  // capacity - 1, capacity is a power of two
+  size_t used;
+} rbtree_index_t;
+
+typedef enum { RBTREE_LAYOUT_INORDER, RBTREE_LAYOUT_VEB } rbtree_layout_t;
+
 typedef struct {
   node_t *root;
   node_t *nil;  // for sentinel
+  node_t *leftmost, *rightmost;  // cached extremes, nil when empty
+  size_t node_size;
+  size_t count_offset;  // 0 when not counted
+  rbtree_monoid_t augment;  // combine == NULL when not augmented
+  rbtree_index_t index;
+  size_t node_count;
+  size_t foreign_count;  // caller-owned nodes linked with rbtree_link
+  rbtree_allocator_t allocator;
+  size_t live_bytes, live_blocks, usable_bytes;
+  struct rbtree_arena **arenas;  // node blocks made by rbtree_compact, by address
+  size_t narenas, arenas_capacity;
+  struct rbtree_arena *reuse;  // arenas with free slots, refilled by inserts
+  struct rbtree_compaction *compaction;  // in-progress rbtree_compact_step
+  rbtree_engine_t engine;
+  size_t rotations;  // since creation, for comparing engines
+  unsigned seed;  // treap priority generator state
 } rbtree;
 
 rbtree *new_rbtree(void);
+rbtree *new_rbtree_opts(const rbtree_opts_t *);
 void delete_rbtree(rbtree *);
 
 node_t *rbtree_insert(rbtree *, const key_t);
@@ -26,6 +108,28 @@ node_t *rbtree_find(const rbtree *, const key_t);
 node_t *rbtree_min(const rbtree *);
 node_t *rbtree_max(const rbtree *);
 int rbtree_erase(rbtree *, node_t *);
+int rbtree_pop_min(rbtree *, key_t *);
+int rbtree_pop_max(rbtree *, key_t *);
 int rbtree_to_array(const rbtree *, key_t *, const size_t);
+node_t *rbtree_next(const rbtree *, const node_t *);
+node_t *rbtree_prev(const rbtree *, const node_t *);
+
+size_t rbtree_count(const rbtree *, const key_t);
+size_t rbtree_node_count(const rbtree *, const node_t *);
+
+agg_t rbtree_aggregate(const rbtree *, const key_t, const key_t);
+
+rbtree_memory_t rbtree_memory_usage(const rbtree *);
+
+int rbtree_compact(rbtree *, const rbtree_layout_t);
+int rbtree_compact_step(rbtree *, const rbtree_layout_t, const size_t);
+
+// intrusive API: the caller owns the nodes, the tree only links them;
+// a tree holds either caller-owned nodes or rbtree_insert ones, never both
+#define rbtree_entry(ptr, type, member) \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+node_t *rbtree_link(rbtree *, node_t *);
+int rbtree_unlink(rbtree *, node_t *);
 
 #endif  // _RBTREE_H_
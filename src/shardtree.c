@@ -0,0 +1,224 @@
+#include "shardtree.h"
+
+#include <stdlib.h>
+
+/*
+* Writers never share a shard: each thread claims its own shard once with
+* shardtree_claim() and inserts only there, so the insert path takes no
+* lock and touches no shared cache line. Merged reads (find, min, max,
+* to_array, iterators) look at every shard and must not run concurrently
+* with writers.
+*/
+
+static void iter_sift_down(shardtree_iter *, size_t);
+
+/*
+* @details Creates a sharded tree of independent rbtrees.
+* @param[in] nshards - The number of shards, typically the number of writer threads.
+* @param[in] opts - Options applied to every shard, or NULL for plain shards.
+* @return A pointer to the newly created shardtree.
+*/
+shardtree *new_shardtree(const size_t nshards, const rbtree_opts_t *opts) {
+  shardtree *s = (shardtree *)calloc(1, sizeof(shardtree));
+
+  s->shards = (rbtree **)calloc(nshards, sizeof(rbtree *));
+  s->nshards = nshards;
+  for (size_t i = 0; i < nshards; i++)
+    s->shards[i] = new_rbtree_opts(opts);
+  atomic_init(&s->claimed, 0);
+  return s;
+}
+
+/*
+* @details Deallocates every shard and the shardtree itself.
+* @param[in] s - A pointer to the shardtree to be deleted.
+* @return void
+*/
+void delete_shardtree(shardtree *s) {
+  for (size_t i = 0; i < s->nshards; i++)
+    delete_rbtree(s->shards[i]);
+  free(s->shards);
+  free(s);
+}
+
+/*
+* @details Hands the calling thread a shard of its own. Lock-free.
+* @param[in] s - A pointer to the shardtree.
+* @return int - The claimed shard index, or -1 once every shard is taken.
+*/
+int shardtree_claim(shardtree *s) {
+  size_t shard = atomic_fetch_add_explicit(&s->claimed, 1, memory_order_relaxed);
+  return shard < s->nshards ? (int)shard : -1;
+}
+
+/*
+* @details Inserts a key into a shard owned by the calling thread.
+* @param[in] s - A pointer to the shardtree.
+* @param[in] shard - A shard index in [0, nshards) returned by shardtree_claim();
+*                    the -1 it returns once every shard is taken is rejected.
+* @param[in] key - The key to be inserted.
+* @return node_t - A pointer to the node holding the key, or NULL for a bad shard.
+*/
+node_t *shardtree_insert(shardtree *s, const int shard, const key_t key) {
+  if (shard < 0 || (size_t)shard >= s->nshards)
+    return NULL;
+  return rbtree_insert(s->shards[shard], key);
+}
+
+/*
+* @details Finds a node with the given key in any shard.
+* @param[in] s - A pointer to the shardtree.
+* @param[in] key - The key value to search for.
+* @param[out] shard - Receives the shard holding the node; may be NULL.
+* @return node_t - A pointer to the found node, or NULL if not found.
+*/
+node_t *shardtree_find(const shardtree *s, const key_t key, int *shard) {
+  for (size_t i = 0; i < s->nshards; i++) {
+    node_t *p = rbtree_find(s->shards[i], key);
+    if (p != NULL) {
+      if (shard != NULL)
+        *shard = (int)i;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/*
+* @details Finds the global minimum from each shard's cached minimum.
+* @param[in] s - A pointer to the shardtree.
+* @param[out] shard - Receives the shard holding the node; may be NULL.
+* @return node_t - The node with the minimum key, or NULL if all shards are empty.
+*/
+node_t *shardtree_min(const shardtree *s, int *shard) {
+  node_t *min_node = NULL;
+
+  for (size_t i = 0; i < s->nshards; i++) {
+    node_t *p = rbtree_min(s->shards[i]);
+    if (p != NULL && (min_node == NULL || p->key < min_node->key)) {
+      min_node = p;
+      if (shard != NULL)
+        *shard = (int)i;
+    }
+  }
+  return min_node;
+}
+
+/*
+* @details Finds the global maximum from each shard's cached maximum.
+* @param[in] s - A pointer to the shardtree.
+* @param[out] shard - Receives the shard holding the node; may be NULL.
+* @return node_t - The node with the maximum key, or NULL if all shards are empty.
+*/
+node_t *shardtree_max(const shardtree *s, int *shard) {
+  node_t *max_node = NULL;
+
+  for (size_t i = 0; i < s->nshards; i++) {
+    node_t *p = rbtree_max(s->shards[i]);
+    if (p != NULL && (max_node == NULL || p->key > max_node->key)) {
+      max_node = p;
+      if (shard != NULL)
+        *shard = (int)i;
+    }
+  }
+  return max_node;
+}
+
+/*
+* @details Merges all shards into one sorted array.
+* @param[in] s - A pointer to the shardtree.
+* @param[out] arr - A pointer to the array to store the keys.
+* @param[in] n - The maximum number of keys to store in the array.
+* @return int - Returns 0 on successful traversal.
+*/
+int shardtree_to_array(const shardtree *s, key_t *arr, const size_t n) {
+  shardtree_iter *it = new_shardtree_iter(s);
+  size_t i = 0;
+  node_t *p;
+  int shard;
+
+  while (i < n && (p = shardtree_iter_next(it, &shard)) != NULL) {
+    for (size_t c = rbtree_node_count(s->shards[shard], p); c > 0 && i < n; c--)
+      arr[i++] = p->key;
+  }
+  delete_shardtree_iter(it);
+  return 0;
+}
+
+/*
+* @details Starts a merged in-order walk over all shards.
+* @param[in] s - A pointer to the shardtree.
+* @return shardtree_iter - A pointer to the iterator, positioned before the minimum.
+*/
+shardtree_iter *new_shardtree_iter(const shardtree *s) {
+  shardtree_iter *it = (shardtree_iter *)calloc(1, sizeof(shardtree_iter));
+
+  it->s = s;
+  it->cur = (node_t **)calloc(s->nshards, sizeof(node_t *));
+  it->heap = (size_t *)calloc(s->nshards, sizeof(size_t));
+  for (size_t i = 0; i < s->nshards; i++) {
+    it->cur[i] = rbtree_min(s->shards[i]);
+    if (it->cur[i] != NULL)
+      it->heap[it->heap_size++] = i;
+  }
+  for (size_t i = it->heap_size / 2; i > 0; i--)
+    iter_sift_down(it, i - 1);
+  return it;
+}
+
+/*
+* @details Returns the next node of the merged walk.
+* @param[in] it - A pointer to the iterator.
+* @param[out] shard - Receives the shard holding the node; may be NULL.
+* @return node_t - The next node in key order, or NULL when every shard is exhausted.
+*/
+node_t *shardtree_iter_next(shardtree_iter *it, int *shard) {
+  if (it->heap_size == 0)
+    return NULL;
+
+  const size_t top = it->heap[0];
+  node_t *p = it->cur[top];
+  if (shard != NULL)
+    *shard = (int)top;
+
+  // advance the winning shard and restore the heap
+  it->cur[top] = rbtree_next(it->s->shards[top], p);
+  if (it->cur[top] == NULL)
+    it->heap[0] = it->heap[--it->heap_size];
+  iter_sift_down(it, 0);
+  return p;
+}
+
+/*
+* @details Deallocates a merged iterator.
+* @param[in] it - A pointer to the iterator.
+* @return void
+*/
+void delete_shardtree_iter(shardtree_iter *it) {
+  free(it->heap);
+  free(it->cur);
+  free(it);
+}
+
+/*
+* @details Moves a heap entry down until its shard's key is no larger than its children's.
+* @param[in] it - A pointer to the iterator.
+* @param[in] i - The heap position to sift.
+* @return void
+*/
+static void iter_sift_down(shardtree_iter *it, size_t i) {
+  for (;;) {
+    size_t smallest = i;
+    size_t child = 2 * i + 1;
+    for (size_t c = child; c < child + 2 && c < it->heap_size; c++) {
+      if (it->cur[it->heap[c]]->key < it->cur[it->heap[smallest]]->key)
+        smallest = c;
+    }
+    if (smallest == i)
+      return;
+    size_t tmp = it->heap[i];
+    it->heap[i] = it->heap[smallest];
+    it->heap[smallest] = tmp;
+    i = smallest;
+  }
+}
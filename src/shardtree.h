@@ -0,0 +1,39 @@
+#ifndef _SHARDTREE_H_
+#define _SHARDTREE_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "rbtree.h"
+
+// one independent rbtree per writer thread, merged on read
+typedef struct {
+  rbtree **shards;
+  size_t nshards;
+  atomic_size_t claimed;  // shards handed out by shardtree_claim
+} shardtree;
+
+// k-way merge over the shards in key order
+typedef struct {
+  const shardtree *s;
+  node_t **cur;  // next unread node of each shard, NULL when exhausted
+  size_t *heap;  // shard indices ordered by cur[i]->key
+  size_t heap_size;
+} shardtree_iter;
+
+shardtree *new_shardtree(const size_t, const rbtree_opts_t *);
+void delete_shardtree(shardtree *);
+
+int shardtree_claim(shardtree *);
+node_t *shardtree_insert(shardtree *, const int, const key_t);
+
+node_t *shardtree_find(const shardtree *, const key_t, int *);
+node_t *shardtree_min(const shardtree *, int *);
+node_t *shardtree_max(const shardtree *, int *);
+int shardtree_to_array(const shardtree *, key_t *, const size_t);
+
+shardtree_iter *new_shardtree_iter(const shardtree *);
+node_t *shardtree_iter_next(shardtree_iter *, int *);
+void delete_shardtree_iter(shardtree_iter *);
+
+#endif  // _SHARDTREE_H_
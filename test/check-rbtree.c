@@ -0,0 +1,161 @@
+#include "check-rbtree.h"
+
+#include <stddef.h>
+
+// Search tree constraint
+// The values of left subtree should be less than or equal to the current node
+// The values of right subtree should be greater than or equal to the current
+// node
+
+static bool search_traverse(const node_t *p, key_t *min, key_t *max,
+                            node_t *nil) {
+  if (p == nil) {
+    return true;
+  }
+
+  *min = *max = p->key;
+
+  key_t l_min, l_max, r_min, r_max;
+  l_min = l_max = r_min = r_max = p->key;
+
+  const bool lr = search_traverse(p->left, &l_min, &l_max, nil);
+  if (!lr || l_max > p->key) {
+    return false;
+  }
+  const bool rr = search_traverse(p->right, &r_min, &r_max, nil);
+  if (!rr || r_min < p->key) {
+    return false;
+  }
+
+  *min = l_min;
+  *max = r_max;
+  return true;
+}
+
+bool check_search_constraint(const rbtree *t) {
+  node_t *p = t->root;
+  key_t min, max;
+#ifdef SENTINEL
+  node_t *nil = t->nil;
+#else
+  node_t *nil = NULL;
+#endif
+  return search_traverse(p, &min, &max, nil);
+}
+
+// Color constraint
+// 1. Each node is either red or black. (by definition)
+// 2. All NIL nodes are considered black.
+// 3. A red node does not have a red child.
+// 4. Every path from a given node to any of its descendant NIL nodes goes
+// through the same number of black nodes.
+
+static bool touch_nil = false;
+static int max_black_depth = 0;
+
+static void init_color_traverse(void) {
+  touch_nil = false;
+  max_black_depth = 0;
+}
+
+static bool color_traverse(const node_t *p, const color_t parent_color,
+                           const int black_depth, node_t *nil) {
+  if (p == nil) {
+    if (!touch_nil) {
+      touch_nil = true;
+      max_black_depth = black_depth;
+    } else if (black_depth != max_black_depth) {
+      return false;
+    }
+    return true;
+  }
+  if (parent_color == RBTREE_RED && p->color == RBTREE_RED) {
+    return false;
+  }
+  int next_depth = ((p->color == RBTREE_BLACK) ? 1 : 0) + black_depth;
+  return color_traverse(p->left, p->color, next_depth, nil) &&
+         color_traverse(p->right, p->color, next_depth, nil);
+}
+
+bool check_color_constraint(const rbtree *t) {
+#ifdef SENTINEL
+  node_t *nil = t->nil;
+#else
+  node_t *nil = NULL;
+#endif
+  node_t *p = t->root;
+  if (p != nil && p->color != RBTREE_BLACK) {
+    return false;
+  }
+
+  init_color_traverse();
+  return color_traverse(p, RBTREE_BLACK, 0, nil);
+}
+
+// Balance constraint of the tree's engine
+// red-black: the color constraint above
+// AVL: stored heights are exact and sibling heights differ by at most one
+// treap: no child has a higher priority than its parent
+
+static int avl_traverse(const node_t *p, node_t *nil) {
+  if (p == nil) {
+    return 0;
+  }
+  const int l = avl_traverse(p->left, nil);
+  const int r = avl_traverse(p->right, nil);
+  if (l < 0 || r < 0 || l - r > 1 || r - l > 1) {
+    return -1;
+  }
+  const int h = 1 + (l > r ? l : r);
+  return p->height == h ? h : -1;
+}
+
+static bool treap_traverse(const node_t *p, node_t *nil) {
+  if (p == nil) {
+    return true;
+  }
+  if ((p->left != nil && p->left->priority > p->priority) ||
+      (p->right != nil && p->right->priority > p->priority)) {
+    return false;
+  }
+  return treap_traverse(p->left, nil) && treap_traverse(p->right, nil);
+}
+
+bool check_balance_constraint(const rbtree *t) {
+#ifdef SENTINEL
+  node_t *nil = t->nil;
+#else
+  node_t *nil = NULL;
+#endif
+  switch (t->engine) {
+    case RBTREE_ENGINE_AVL:
+      return avl_traverse(t->root, nil) >= 0;
+    case RBTREE_ENGINE_TREAP:
+      return treap_traverse(t->root, nil);
+    default:
+      return check_color_constraint(t);
+  }
+}
+
+// Link constraint
+// Every child points back to its parent and the root's parent is NIL.
+
+static bool parent_traverse(const node_t *p, const node_t *parent,
+                            node_t *nil) {
+  if (p == nil) {
+    return true;
+  }
+  if (p->parent != parent) {
+    return false;
+  }
+  return parent_traverse(p->left, p, nil) && parent_traverse(p->right, p, nil);
+}
+
+bool check_parent_links(const rbtree *t) {
+#ifdef SENTINEL
+  node_t *nil = t->nil;
+#else
+  node_t *nil = NULL;
+#endif
+  return parent_traverse(t->root, nil, nil);
+}
@@ -0,0 +1,15 @@
+#ifndef _CHECK_RBTREE_H_
+#define _CHECK_RBTREE_H_
+
+#include <rbtree.h>
+#include <stdbool.h>
+
+#define SENTINEL
+
+// non-aborting invariant checks shared by test-rbtree and fuzz-rbtree
+bool check_search_constraint(const rbtree *);
+bool check_color_constraint(const rbtree *);
+bool check_balance_constraint(const rbtree *);
+bool check_parent_links(const rbtree *);
+
+#endif  // _CHECK_RBTREE_H_
@@ -0,0 +1,649 @@
+#include <fcntl.h>
+#include <rbtree.h>
+#include <shardtree.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "check-rbtree.h"
+
+// Differential fuzzer: replays an operation sequence against every tree
+// variant and a sorted reference array, checking all invariants after each
+// mutation.
+//
+// Input format: one config byte (CFG_* bits), then 3-byte operations
+// (op, a, b). Keys are (int8_t)a so short inputs hit plenty of duplicates.
+//
+// Built with -DLIBFUZZER it is a libFuzzer target. Otherwise it runs random
+// inputs, shrinks any failing one and writes it out as a reproducer that can
+// be replayed with `fuzz-rbtree <file>`.
+
+enum {
+  CFG_COUNTED = 1,
+  CFG_AUGMENT = 2,
+  CFG_HASH = 4,
+  CFG_INTRUSIVE = 8,
+  CFG_SHARDED = 16,
+  CFG_ENGINE_SHIFT = 5,  // two bits: rbtree_engine_t
+};
+
+#define CFG_ENGINE(cfg) ((rbtree_engine_t)((cfg) >> CFG_ENGINE_SHIFT & 3))
+
+enum {
+  OP_INSERT,
+  OP_ERASE,
+  OP_POP_MIN,
+  OP_POP_MAX,
+  OP_COUNT,
+  OP_AGGREGATE,
+  OP_TO_ARRAY,
+  OP_COMPACT,
+  OP_KINDS
+};
+
+static const char *op_names[] = {"insert", "erase", "pop_min",  "pop_max",
+                                 "count",  "aggregate", "to_array",
+                                 "compact"};
+
+#define MAX_OPS 4096
+#define NSHARDS 3
+
+static const char *failure;  // first failed check of the last replay
+static int failure_line;
+
+#define CHECK(cond)                \
+  do {                             \
+    if (!(cond)) {                 \
+      fail(#cond, __LINE__);       \
+      return false;                \
+    }                              \
+  } while (0)
+
+static void fail(const char *what, const int line) {
+  // keep the innermost check; the callers' CHECKs fail right after it
+  if (failure == NULL) {
+    failure = what;
+    failure_line = line;
+  }
+#ifdef LIBFUZZER
+  fprintf(stderr, "check failed at line %d: %s\n", line, what);
+  abort();
+#endif
+}
+
+typedef struct {
+  size_t blocks;
+} alloc_counter_t;
+
+static void *counting_alloc(void *ctx, const size_t size) {
+  ((alloc_counter_t *)ctx)->blocks++;
+  return malloc(size);
+}
+
+static void counting_free(void *ctx, void *ptr, const size_t size) {
+  ((alloc_counter_t *)ctx)->blocks--;
+  free(ptr);
+}
+
+static agg_t sum_lift(const key_t key) { return key; }
+static agg_t sum_combine(const agg_t a, const agg_t b) { return a + b; }
+
+typedef struct {
+  int cfg;
+  rbtree *t;      // every variant but CFG_SHARDED
+  shardtree *s;   // CFG_SHARDED
+  rbtree_aug_node_t *pool;  // caller-owned nodes for CFG_INTRUSIVE
+  rbtree_aug_node_t **free_nodes;
+  size_t nfree;
+  key_t ref[MAX_OPS];  // reference multiset, sorted
+  size_t nref;
+  alloc_counter_t counter;
+} fuzz_t;
+
+static size_t ref_lower_bound(const fuzz_t *f, const key_t key) {
+  size_t lo = 0, hi = f->nref;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (f->ref[mid] < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static size_t ref_count(const fuzz_t *f, const key_t key) {
+  size_t i = ref_lower_bound(f, key);
+  size_t c = 0;
+  while (i + c < f->nref && f->ref[i + c] == key) {
+    c++;
+  }
+  return c;
+}
+
+static void ref_insert(fuzz_t *f, const key_t key) {
+  size_t i = ref_lower_bound(f, key);
+  memmove(&f->ref[i + 1], &f->ref[i], (f->nref - i) * sizeof(key_t));
+  f->ref[i] = key;
+  f->nref++;
+}
+
+static void ref_remove(fuzz_t *f, const key_t key) {
+  size_t i = ref_lower_bound(f, key);
+  memmove(&f->ref[i], &f->ref[i + 1], (f->nref - i - 1) * sizeof(key_t));
+  f->nref--;
+}
+
+static size_t tree_count(const fuzz_t *f) {
+  return f->cfg & CFG_SHARDED ? NSHARDS : 1;
+}
+
+static rbtree *tree_at(const fuzz_t *f, const size_t i) {
+  return f->cfg & CFG_SHARDED ? f->s->shards[i] : f->t;
+}
+
+// every node's aggregate must be the sum over its subtree
+static bool check_aggregates(const rbtree *t, const node_t *p, agg_t *sum) {
+  if (p == t->nil) {
+    *sum = 0;
+    return true;
+  }
+  agg_t l, r;
+  CHECK(check_aggregates(t, p->left, &l));
+  CHECK(check_aggregates(t, p->right, &r));
+  *sum = l + (agg_t)p->key * rbtree_node_count(t, p) + r;
+  CHECK(((const rbtree_aug_node_t *)p)->agg == *sum);
+  return true;
+}
+
+static bool check_tree(const fuzz_t *f, const rbtree *t) {
+  CHECK(check_search_constraint(t));
+  CHECK(check_balance_constraint(t));
+  CHECK(check_parent_links(t));
+
+  // in-order walk against the node count and the cached extremes
+  size_t nodes = 0;
+  node_t *last = NULL;
+  for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) {
+    CHECK(last == NULL || last->key <= p->key);
+    CHECK(!(f->cfg & CFG_COUNTED) || last == NULL || last->key < p->key);
+    // lookups (through the hash index too) must land on a linked node
+    const node_t *q = rbtree_find(t, p->key);
+    CHECK(q != NULL && q->key == p->key);
+    CHECK(q->parent == t->nil ? t->root == q
+                              : q->parent->left == q || q->parent->right == q);
+    last = p;
+    nodes++;
+  }
+  CHECK(last == rbtree_max(t));
+  CHECK(nodes == rbtree_memory_usage(t).node_count);
+
+  if (f->cfg & CFG_AUGMENT) {
+    agg_t sum;
+    CHECK(check_aggregates(t, t->root, &sum));
+  }
+  return true;
+}
+
+static bool check_all(const fuzz_t *f) {
+  for (size_t i = 0; i < tree_count(f); i++) {
+    CHECK(check_tree(f, tree_at(f, i)));
+  }
+
+  // merged contents, duplicates expanded, must equal the reference
+  size_t i = 0;
+  if (f->cfg & CFG_SHARDED) {
+    shardtree_iter *it = new_shardtree_iter(f->s);
+    node_t *p;
+    int shard;
+    while ((p = shardtree_iter_next(it, &shard)) != NULL) {
+      for (size_t c = rbtree_node_count(f->s->shards[shard], p); c > 0; c--) {
+        if (i >= f->nref || f->ref[i] != p->key) {
+          delete_shardtree_iter(it);
+          CHECK(!"merged iteration differs from reference");
+        }
+        i++;
+      }
+    }
+    delete_shardtree_iter(it);
+  } else {
+    for (node_t *p = rbtree_min(f->t); p != NULL; p = rbtree_next(f->t, p)) {
+      for (size_t c = rbtree_node_count(f->t, p); c > 0; c--) {
+        CHECK(i < f->nref && f->ref[i] == p->key);
+        i++;
+      }
+    }
+  }
+  CHECK(i == f->nref);
+  return true;
+}
+
+static node_t *find_any(const fuzz_t *f, const key_t key, rbtree **owner) {
+  int shard = 0;
+  node_t *p = f->cfg & CFG_SHARDED ? shardtree_find(f->s, key, &shard)
+                                   : rbtree_find(f->t, key);
+  *owner = tree_at(f, shard);
+  return p;
+}
+
+static void remove_node(fuzz_t *f, rbtree *t, node_t *p) {
+  if (f->cfg & CFG_INTRUSIVE) {
+    rbtree_unlink(t, p);
+    f->free_nodes[f->nfree++] = (rbtree_aug_node_t *)p;
+  } else {
+    rbtree_erase(t, p);
+  }
+}
+
+static bool do_pop(fuzz_t *f, const bool min) {
+  const bool plain = !(f->cfg & (CFG_SHARDED | CFG_INTRUSIVE));
+  key_t key;
+
+  if (f->nref == 0) {
+    if (plain) {
+      CHECK((min ? rbtree_pop_min(f->t, &key) : rbtree_pop_max(f->t, &key)) ==
+            -1);
+    }
+    CHECK((f->cfg & CFG_SHARDED ? shardtree_min(f->s, NULL)
+                                : rbtree_min(f->t)) == NULL);
+    return true;
+  }
+
+  const key_t expect = min ? f->ref[0] : f->ref[f->nref - 1];
+  if (f->cfg & CFG_INTRUSIVE) {
+    // pop would have to free the caller's node, so it refuses
+    CHECK((min ? rbtree_pop_min(f->t, &key) : rbtree_pop_max(f->t, &key)) ==
+          -1);
+    CHECK(rbtree_erase(f->t, rbtree_min(f->t)) == -1);
+  }
+  if (plain) {
+    CHECK((min ? rbtree_pop_min(f->t, &key) : rbtree_pop_max(f->t, &key)) == 0);
+  } else {
+    int shard = 0;
+    node_t *p;
+    if (f->cfg & CFG_SHARDED) {
+      p = min ? shardtree_min(f->s, &shard) : shardtree_max(f->s, &shard);
+    } else {
+      p = min ? rbtree_min(f->t) : rbtree_max(f->t);
+    }
+    CHECK(p != NULL);
+    key = p->key;
+    remove_node(f, tree_at(f, shard), p);
+  }
+  CHECK(key == expect);
+  ref_remove(f, key);
+  return true;
+}
+
+static bool do_op(fuzz_t *f, const uint8_t op, const uint8_t a,
+                  const uint8_t b) {
+  const key_t key = (int8_t)a;
+  rbtree *owner;
+  node_t *p;
+
+  switch (op % OP_KINDS) {
+    case OP_INSERT:
+      if (f->cfg & CFG_SHARDED) {
+        p = shardtree_insert(f->s, b % NSHARDS, key);
+      } else if (f->cfg & CFG_INTRUSIVE) {
+        // a tree holding caller-owned nodes must not allocate its own
+        CHECK(f->t->foreign_count == 0 || rbtree_insert(f->t, key) == NULL);
+        rbtree_aug_node_t *n = f->free_nodes[--f->nfree];
+        n->node.key = key;
+        p = rbtree_link(f->t, &n->node);
+        CHECK(p == &n->node);
+      } else {
+        // ...and a tree holding its own nodes must not link the caller's
+        rbtree_aug_node_t stray = {.node.key = key};
+        CHECK(f->t->node_count == 0 || rbtree_link(f->t, &stray.node) == NULL);
+        p = rbtree_insert(f->t, key);
+      }
+      CHECK(p != NULL && p->key == key);
+      ref_insert(f, key);
+      return check_all(f);
+
+    case OP_ERASE:
+      p = find_any(f, key, &owner);
+      CHECK((p != NULL) == (ref_count(f, key) > 0));
+      if (p == NULL) {
+        return true;
+      }
+      CHECK(p->key == key);
+      // only compaction moves nodes; the extremes stay where they were
+      node_t *lo = rbtree_min(owner), *hi = rbtree_max(owner);
+      remove_node(f, owner, p);
+      ref_remove(f, key);
+      CHECK(lo == p || rbtree_min(owner) == lo);
+      CHECK(hi == p || rbtree_max(owner) == hi);
+      return check_all(f);
+
+    case OP_POP_MIN:
+    case OP_POP_MAX:
+      CHECK(do_pop(f, op % OP_KINDS == OP_POP_MIN));
+      return check_all(f);
+
+    case OP_COUNT: {
+      size_t c = 0;
+      for (size_t i = 0; i < tree_count(f); i++) {
+        c += rbtree_count(tree_at(f, i), key);
+      }
+      CHECK(c == ref_count(f, key));
+      return true;
+    }
+
+    case OP_AGGREGATE: {
+      if (!(f->cfg & CFG_AUGMENT)) {
+        return true;
+      }
+      const key_t hi = key + b % 64;
+      agg_t got = 0, want = 0;
+      for (size_t i = 0; i < tree_count(f); i++) {
+        got += rbtree_aggregate(tree_at(f, i), key, hi);
+      }
+      for (size_t i = ref_lower_bound(f, key); i < f->nref && f->ref[i] <= hi;
+           i++) {
+        want += f->ref[i];
+      }
+      CHECK(got == want);
+      return true;
+    }
+
+    case OP_TO_ARRAY: {
+      // a bounded prefix, with a canary right behind it
+      const size_t n = f->nref == 0 ? 0 : b % (f->nref + 1);
+      key_t res[MAX_OPS + 1];
+      res[n] = 0x5a5a5a5a;
+      if (f->cfg & CFG_SHARDED) {
+        shardtree_to_array(f->s, res, n);
+      } else {
+        rbtree_to_array(f->t, res, n);
+      }
+      CHECK(memcmp(res, f->ref, n * sizeof(key_t)) == 0);
+      CHECK(res[n] == 0x5a5a5a5a);
+      return true;
+    }
+
+    case OP_COMPACT: {
+      // b picks the layout and a slice budget; a short slice is left pending
+      const rbtree_layout_t layout = b & 1 ? RBTREE_LAYOUT_VEB
+                                           : RBTREE_LAYOUT_INORDER;
+      for (size_t i = 0; i < tree_count(f); i++) {
+        rbtree *t = tree_at(f, i);
+        const int r = rbtree_compact_step(t, layout, (b >> 1) % 16 + 1);
+        CHECK((r == -1) == (t->foreign_count > 0));
+      }
+      return check_all(f);
+    }
+  }
+  return true;
+}
+
+static int normalize_cfg(int cfg) {
+  // caller-owned nodes can neither be merged nor spread over shards
+  if (cfg & CFG_INTRUSIVE) {
+    cfg &= ~(CFG_COUNTED | CFG_SHARDED);
+  }
+  // there are three engines; the fourth value falls back to red-black
+  if (CFG_ENGINE(cfg) > RBTREE_ENGINE_TREAP) {
+    cfg &= ~(3 << CFG_ENGINE_SHIFT);
+  }
+  return cfg & 127;
+}
+
+// replays one input; false (with failure set) if any check failed
+static bool replay(const uint8_t *data, size_t size) {
+  static fuzz_t f;
+  const rbtree_monoid_t sum = {0, sum_lift, sum_combine};
+  const rbtree_allocator_t shim = {counting_alloc, counting_free, NULL, 0,
+                                   &f.counter};
+
+  if (size == 0) {
+    return true;
+  }
+  memset(&f, 0, sizeof(f));
+  failure = NULL;
+  f.cfg = normalize_cfg(data[0]);
+  data++;
+  size--;
+  if (size / 3 > MAX_OPS) {
+    size = MAX_OPS * 3;
+  }
+
+  const rbtree_opts_t opts = {
+      .augment = f.cfg & CFG_AUGMENT ? &sum : NULL,
+      .counted = f.cfg & CFG_COUNTED,
+      .hash_index = f.cfg & CFG_HASH,
+      .allocator = &shim,
+      .engine = CFG_ENGINE(f.cfg),
+  };
+  if (f.cfg & CFG_SHARDED) {
+    f.s = new_shardtree(NSHARDS, &opts);
+  } else {
+    f.t = new_rbtree_opts(&opts);
+  }
+  if (f.cfg & CFG_INTRUSIVE) {
+    f.pool = calloc(MAX_OPS, sizeof(rbtree_aug_node_t));
+    f.free_nodes = calloc(MAX_OPS, sizeof(rbtree_aug_node_t *));
+    for (size_t i = 0; i < MAX_OPS; i++) {
+      f.free_nodes[f.nfree++] = &f.pool[i];
+    }
+  }
+
+  bool ok = true;
+  for (size_t i = 0; ok && i + 3 <= size; i += 3) {
+    ok = do_op(&f, data[i], data[i + 1], data[i + 2]);
+  }
+
+  if (f.cfg & CFG_SHARDED) {
+    delete_shardtree(f.s);
+  } else {
+    delete_rbtree(f.t);
+  }
+  free(f.free_nodes);
+  free(f.pool);
+  if (ok && f.counter.blocks != 0) {
+    fail("tree leaked blocks", __LINE__);
+    ok = false;
+  }
+  return ok;
+}
+
+#ifdef LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  replay(data, size);
+  return 0;
+}
+
+#else
+
+static const uint8_t *current_input;  // dumped if a replay crashes
+static size_t current_size;
+
+static void write_input(const char *path, const uint8_t *data,
+                        const size_t size) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0) {
+    if (write(fd, data, size) < 0) {
+      // nothing left to report to
+    }
+    close(fd);
+  }
+}
+
+static void on_crash(int sig) {
+  static const char msg[] = "crashed, input saved to fuzz-rbtree-crash.bin\n";
+  write_input("fuzz-rbtree-crash.bin", current_input, current_size);
+  if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {
+    // exiting anyway
+  }
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+static bool replay_guarded(const uint8_t *data, const size_t size) {
+  current_input = data;
+  current_size = size;
+  return replay(data, size);
+}
+
+// drops chunks of operations, then config bits, while the input keeps failing
+static size_t minimize(uint8_t *data, size_t size) {
+  uint8_t *candidate = malloc(size);
+  bool progress = true;
+
+  while (progress) {
+    progress = false;
+    size_t nops = (size - 1) / 3;
+    for (size_t chunk = nops / 2 > 0 ? nops / 2 : 1; chunk > 0; chunk /= 2) {
+      for (size_t start = 0; start + chunk <= nops;) {
+        const size_t cut = 1 + start * 3;
+        const size_t len = chunk * 3;
+        memcpy(candidate, data, cut);
+        memcpy(candidate + cut, data + cut + len, size - cut - len);
+        if (!replay_guarded(candidate, size - len)) {
+          memcpy(data, candidate, size - len);
+          size -= len;
+          nops -= chunk;
+          progress = true;
+        } else {
+          start += chunk;
+        }
+      }
+    }
+    for (int bit = 1; bit < 32; bit <<= 1) {
+      if (data[0] & bit) {
+        data[0] &= ~bit;
+        if (replay_guarded(data, size)) {
+          data[0] |= bit;
+        } else {
+          progress = true;
+        }
+      }
+    }
+  }
+  free(candidate);
+  replay_guarded(data, size);  // leave the final failure in `failure`
+  return size;
+}
+
+static void dump_input(const uint8_t *data, const size_t size) {
+  const int cfg = normalize_cfg(data[0]);
+  static const char *engines[] = {"rb", "avl", "treap"};
+  printf("config: %s%s%s%s%s%s\n", engines[CFG_ENGINE(cfg)],
+         cfg & CFG_COUNTED ? " counted" : "",
+         cfg & CFG_AUGMENT ? " augment" : "", cfg & CFG_HASH ? " hash" : "",
+         cfg & CFG_INTRUSIVE ? " intrusive" : "",
+         cfg & CFG_SHARDED ? " sharded" : "");
+  for (size_t i = 1; i + 3 <= size; i += 3) {
+    printf("  %-9s key %4d  b %3u\n", op_names[data[i] % OP_KINDS],
+           (int8_t)data[i + 1], data[i + 2]);
+  }
+}
+
+static size_t random_input(uint8_t *data, const size_t max_ops) {
+  static const int key_ranges[] = {4, 16, 64, 256};
+  const int range = key_ranges[rand() % 4];
+  const size_t nops = 1 + rand() % max_ops;
+
+  data[0] = rand();
+  for (size_t i = 0; i < nops; i++) {
+    // inserts dominate so trees grow deep enough to exercise the fixups
+    const int r = rand() % 16;
+    data[1 + i * 3] = r < 6 ? OP_INSERT : r < 10 ? OP_ERASE : r - 8;
+    data[2 + i * 3] = (uint8_t)(rand() % range - range / 2);
+    data[3 + i * 3] = rand();
+  }
+  return 1 + nops * 3;
+}
+
+static int replay_file(const char *path) {
+  uint8_t data[1 + MAX_OPS * 3];
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    perror(path);
+    return 2;
+  }
+  const size_t size = fread(data, 1, sizeof(data), fp);
+  fclose(fp);
+
+  dump_input(data, size);
+  if (!replay_guarded(data, size)) {
+    printf("%s: FAILED at line %d: %s\n", path, failure_line, failure);
+    return 1;
+  }
+  printf("%s: passed\n", path);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long iterations = 1000;
+  unsigned int seed = time(NULL);
+  double seconds = 0;
+  size_t max_ops = 512;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:t:m:")) != -1) {
+    switch (opt) {
+      case 'n': iterations = strtoul(optarg, NULL, 10); break;
+      case 's': seed = strtoul(optarg, NULL, 10); break;
+      case 't': seconds = atof(optarg); iterations = (unsigned long)-1; break;
+      case 'm': max_ops = strtoul(optarg, NULL, 10); break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-n iterations] [-s seed] [-t seconds] [-m max_ops]"
+                " [reproducer...]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (max_ops == 0 || max_ops > MAX_OPS) {
+    max_ops = MAX_OPS;
+  }
+  signal(SIGSEGV, on_crash);
+  signal(SIGABRT, on_crash);
+
+  if (optind < argc) {
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+      status |= replay_file(argv[i]);
+    }
+    return status;
+  }
+
+  static uint8_t data[1 + MAX_OPS * 3];
+  const time_t deadline = time(NULL) + (time_t)seconds;
+  srand(seed);
+  for (unsigned long it = 0; it < iterations; it++) {
+    if (seconds > 0 && time(NULL) >= deadline) {
+      iterations = it;
+      break;
+    }
+    size_t size = random_input(data, max_ops);
+    if (replay_guarded(data, size)) {
+      continue;
+    }
+
+    printf("seed %u iteration %lu: FAILED at line %d: %s\n", seed, it,
+           failure_line, failure);
+    size = minimize(data, size);
+    char path[64];
+    snprintf(path, sizeof(path), "fuzz-rbtree-repro-%u-%lu.bin", seed, it);
+    write_input(path, data, size);
+    printf("minimized to %zu ops, still failing at line %d: %s\n",
+           (size - 1) / 3, failure_line, failure);
+    dump_input(data, size);
+    printf("reproducer written to %s\n", path);
+    return 1;
+  }
+  printf("fuzz-rbtree: %lu random inputs passed (seed %u)\n", iterations, seed);
+  return 0;
+}
+
+#endif  // LIBFUZZER
@@ -1,15 +1,37 @@
 #include <assert.h>
+#include <batchfind.h>
+#include <pthread.h>
 #include <rbtree.h>
+#include <shardtree.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "check-rbtree.h"
 
 #define SENTINEL
 
+// balancing engine under test; the Makefile builds one binary per engine
+#ifndef TEST_ENGINE
+#define TEST_ENGINE RBTREE_ENGINE_RB
+#endif
+
+// every tree below except test_init's is made here, on the engine under test
+static rbtree *new_tree(const rbtree_opts_t *opts) {
+  rbtree_opts_t engine_opts = {0};
+  if (opts != NULL) {
+    engine_opts = *opts;
+  }
+  engine_opts.engine = TEST_ENGINE;
+  return new_rbtree_opts(&engine_opts);
+}
+
 // new_rbtree should return rbtree struct with null root node
 void test_init(void) {
   rbtree *t = new_rbtree();
   assert(t != NULL);
+  assert(t->engine == RBTREE_ENGINE_RB);
 #ifdef SENTINEL
   assert(t->nil != NULL);
   assert(t->root == t->nil);
@@ -21,7 +43,7 @@ void test_init(void) {
 
 // root node should have proper values and pointers
 void test_insert_single(const key_t key) {
-  rbtree *t = new_rbtree();
+  rbtree *t = new_tree(NULL);
   node_t *p = rbtree_insert(t, key);
   assert(p != NULL);
   assert(t->root == p);
@@ -41,7 +63,7 @@ void test_insert_single(const key_t key) {
 
 // find should return the node with the key or NULL if no such node exists
 void test_find_single(const key_t key, const key_t wrong_key) {
-  rbtree *t = new_rbtree();
+  rbtree *t = new_tree(NULL);
   node_t *p = rbtree_insert(t, key);
 
   node_t *q = rbtree_find(t, key);
@@ -57,7 +79,7 @@ void test_find_single(const key_t key, const key_t wrong_key) {
 
 // erase should delete root node
 void test_erase_root(const key_t key) {
-  rbtree *t = new_rbtree();
+  rbtree *t = new_tree(NULL);
   node_t *p = rbtree_insert(t, key);
   assert(p != NULL);
   assert(t->root == p);
@@ -96,7 +118,7 @@ void test_minmax(key_t *arr, const size_t n) {
   // null array is not allowed
   assert(n > 0 && arr != NULL);
 
-  rbtree *t = new_rbtree();
+  rbtree *t = new_tree(NULL);
   assert(t != NULL);
 
   insert_arr(t, arr, n);
@@ -144,9 +166,9 @@ void test_to_array(rbtree *t, const key_t *arr, const size_t n) {
 }
 
 void test_multi_instance() {
-  rbtree *t1 = new_rbtree();
+  rbtree *t1 = new_tree(NULL);
   assert(t1 != NULL);
-  rbtree *t2 = new_rbtree();
+  rbtree *t2 = new_tree(NULL);
   assert(t2 != NULL);
 
   key_t arr1[] = {10, 5, 8, 34, 67, 23, 156, 24, 2, 12, 24, 36, 990, 25};
@@ -177,105 +199,25 @@ void test_multi_instance() {
   delete_rbtree(t1);
 }
 
-// Search tree constraint
-// The values of left subtree should be less than or equal to the current node
-// The values of right subtree should be greater than or equal to the current
-// node
-
-static bool search_traverse(const node_t *p, key_t *min, key_t *max,
-                            node_t *nil) {
-  if (p == nil) {
-    return true;
-  }
-
-  *min = *max = p->key;
-
-  key_t l_min, l_max, r_min, r_max;
-  l_min = l_max = r_min = r_max = p->key;
-
-  const bool lr = search_traverse(p->left, &l_min, &l_max, nil);
-  if (!lr || l_max > p->key) {
-    return false;
-  }
-  const bool rr = search_traverse(p->right, &r_min, &r_max, nil);
-  if (!rr || r_min < p->key) {
-    return false;
-  }
-
-  *min = l_min;
-  *max = r_max;
-  return true;
-}
-
 void test_search_constraint(const rbtree *t) {
   assert(t != NULL);
-  node_t *p = t->root;
-  key_t min, max;
-#ifdef SENTINEL
-  node_t *nil = t->nil;
-#else
-  node_t *nil = NULL;
-#endif
-  assert(search_traverse(p, &min, &max, nil));
-}
-
-// Color constraint
-// 1. Each node is either red or black. (by definition)
-// 2. All NIL nodes are considered black.
-// 3. A red node does not have a red child.
-// 4. Every path from a given node to any of its descendant NIL nodes goes
-// through the same number of black nodes.
-
-bool touch_nil = false;
-int max_black_depth = 0;
-
-static void init_color_traverse(void) {
-  touch_nil = false;
-  max_black_depth = 0;
+  assert(check_search_constraint(t));
 }
 
-static bool color_traverse(const node_t *p, const color_t parent_color,
-                           const int black_depth, node_t *nil) {
-  if (p == nil) {
-    if (!touch_nil) {
-      touch_nil = true;
-      max_black_depth = black_depth;
-    } else if (black_depth != max_black_depth) {
-      return false;
-    }
-    return true;
-  }
-  if (parent_color == RBTREE_RED && p->color == RBTREE_RED) {
-    return false;
-  }
-  int next_depth = ((p->color == RBTREE_BLACK) ? 1 : 0) + black_depth;
-  return color_traverse(p->left, p->color, next_depth, nil) &&
-         color_traverse(p->right, p->color, next_depth, nil);
-}
-
-void test_color_constraint(const rbtree *t) {
+void test_balance_constraint(const rbtree *t) {
   assert(t != NULL);
-#ifdef SENTINEL
-  node_t *nil = t->nil;
-#else
-  node_t *nil = NULL;
-#endif
-  node_t *p = t->root;
-  assert(p == nil || p->color == RBTREE_BLACK);
-
-  init_color_traverse();
-  assert(color_traverse(p, RBTREE_BLACK, 0, nil));
+  assert(check_balance_constraint(t));
 }
 
-// rbtree should keep search tree and color constraints
+// rbtree should keep search tree and balance constraints
 void test_rb_constraints(const key_t arr[], const size_t n) {
-  rbtree *t = new_rbtree();
+  rbtree *t = new_tree(NULL);
   assert(t != NULL);
 
   insert_arr(t, arr, n);
   assert(t->root != NULL);
 
-  test_color_constraint(t);
+  test_balance_constraint(t);
   test_search_constraint(t);
 
   delete_rbtree(t);
@@ -302,7 +244,7 @@ void test_minmax_suite() {
 }
 
 void test_to_array_suite() {
-  rbtree *t = new_rbtree();
+  rbtree *t = new_tree(NULL);
   assert(t != NULL);
 
   key_t entries[] = {10, 5, 8, 34, 67, 23, 156, 24, 2, 12, 24, 36, 990, 25};
@@ -324,6 +266,12 @@ void test_find_erase(rbtree *t, const key_t *arr, const size_t n) {
     assert(p != NULL);
     assert(p->key == arr[i]);
     rbtree_erase(t, p);
+    // erase fixup must keep the constraints, not just insert fixup
+    if (n <= 100 || i % 256 == 0) {
+      test_balance_constraint(t);
+      test_search_constraint(t);
+      assert(check_parent_links(t));
+    }
   }
 
   for (int i = 0; i < n; i++) {
@@ -347,7 +295,7 @@ void test_find_erase(rbtree *t, const key_t *arr, const size_t n) {
 void test_find_erase_fixed() {
   const key_t arr[] = {10, 5, 8, 34, 67, 23, 156, 24, 2, 12, 24, 36, 990, 25};
   const size_t n = sizeof(arr) / sizeof(arr[0]);
-  rbtree *t = new_rbtree();
+  rbtree *t = new_tree(NULL);
   assert(t != NULL);
 
   test_find_erase(t, arr, n);
@@ -357,7 +305,7 @@ void test_find_erase_fixed() {
 
 void test_find_erase_rand(const size_t n, const unsigned int seed) {
   srand(seed);
-  rbtree *t = new_rbtree();
+  rbtree *t = new_tree(NULL);
   key_t *arr = calloc(n, sizeof(key_t));
   for (int i = 0; i < n; i++) {
     arr[i] = rand();
@@ -369,6 +317,868 @@ void test_find_erase_rand(const size_t n, const unsigned int seed) {
   delete_rbtree(t);
 }
 
+static agg_t sum_lift(const key_t key) { return key; }
+static agg_t sum_combine(const agg_t a, const agg_t b) { return a + b; }
+
+// leftmost key of the range: catches combines applied out of order
+static agg_t first_lift(const key_t key) { return key; }
+static agg_t first_combine(const agg_t a, const agg_t b) {
+  return a != -1 ? a : b;
+}
+
+static agg_t brute_aggregate(const rbtree_monoid_t *m, const key_t *sorted,
+                             const size_t n, const key_t lo, const key_t hi) {
+  agg_t acc = m->identity;
+  for (size_t i = 0; i < n; i++) {
+    if (sorted[i] >= lo && sorted[i] <= hi) {
+      acc = m->combine(acc, m->lift(sorted[i]));
+    }
+  }
+  return acc;
+}
+
+// augmented tree should answer range aggregates through inserts and erases
+void test_augment(const rbtree_monoid_t *m, const size_t n,
+                  const unsigned int seed) {
+  srand(seed);
+  const rbtree_opts_t opts = {.augment = m};
+  rbtree *t = new_tree(&opts);
+  assert(t != NULL);
+
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % 1000;
+    rbtree_insert(t, arr[i]);
+  }
+  test_balance_constraint(t);
+  test_search_constraint(t);
+
+  // erase every other key, duplicates included
+  for (int i = 0; i < n; i += 2) {
+    node_t *p = rbtree_find(t, arr[i]);
+    assert(p != NULL);
+    rbtree_erase(t, p);
+  }
+  size_t m_left = 0;
+  for (int i = 1; i < n; i += 2) {
+    arr[m_left++] = arr[i];
+  }
+  qsort((void *)arr, m_left, sizeof(key_t), comp);
+  test_balance_constraint(t);
+  test_search_constraint(t);
+
+  for (int i = 0; i < 200; i++) {
+    key_t lo = rand() % 1100 - 50;
+    key_t hi = lo + rand() % 300;
+    assert(rbtree_aggregate(t, lo, hi) ==
+           brute_aggregate(m, arr, m_left, lo, hi));
+  }
+  assert(rbtree_aggregate(t, 10, 5) == m->identity);
+
+  free(arr);
+  delete_rbtree(t);
+}
+
+void test_augment_suite() {
+  const rbtree_monoid_t sum = {0, sum_lift, sum_combine};
+  const rbtree_monoid_t first = {-1, first_lift, first_combine};
+  test_augment(&sum, 2000, 26);
+  test_augment(&first, 2000, 27);
+}
+
+// count should match a plain multiset and a counted tree alike
+void test_count(const int counted, const size_t n, const unsigned int seed) {
+  srand(seed);
+  const rbtree_monoid_t sum = {0, sum_lift, sum_combine};
+  const rbtree_opts_t opts = {.augment = &sum, .counted = counted};
+  rbtree *t = new_tree(&opts);
+  assert(t != NULL);
+
+  key_t *arr = calloc(n, sizeof(key_t));
+  size_t hist[50] = {0};
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % 50;
+    node_t *p = rbtree_insert(t, arr[i]);
+    assert(p != NULL && p->key == arr[i]);
+    hist[arr[i]]++;
+  }
+  test_balance_constraint(t);
+  test_search_constraint(t);
+
+  // drop a third of the occurrences again
+  for (int i = 0; i < n; i += 3) {
+    node_t *p = rbtree_find(t, arr[i]);
+    assert(p != NULL);
+    rbtree_erase(t, p);
+    hist[arr[i]]--;
+  }
+  test_balance_constraint(t);
+  test_search_constraint(t);
+
+  size_t total = 0;
+  agg_t total_sum = 0;
+  for (key_t k = 0; k < 50; k++) {
+    assert(rbtree_count(t, k) == hist[k]);
+    assert(rbtree_aggregate(t, k, k) == (agg_t)k * hist[k]);
+    total += hist[k];
+    total_sum += (agg_t)k * hist[k];
+  }
+  assert(rbtree_count(t, 50) == 0);
+  assert(rbtree_aggregate(t, 0, 49) == total_sum);
+
+  // duplicates are expanded and the array bound is respected
+  key_t *res = calloc(total + 1, sizeof(key_t));
+  res[total] = -1;
+  rbtree_to_array(t, res, total);
+  size_t i = 0;
+  for (key_t k = 0; k < 50; k++) {
+    for (size_t c = 0; c < hist[k]; c++) {
+      assert(res[i++] == k);
+    }
+  }
+  assert(res[total] == -1);
+
+  free(res);
+  free(arr);
+  delete_rbtree(t);
+}
+
+void test_count_suite() {
+  test_count(0, 3000, 28);
+  test_count(1, 3000, 28);
+}
+
+// indexed find should agree with the tree through inserts and erases
+void test_hash_index(const int counted, const size_t n,
+                     const unsigned int seed) {
+  srand(seed);
+  const rbtree_opts_t opts = {.counted = counted, .hash_index = 1};
+  rbtree *t = new_tree(&opts);
+  assert(t != NULL);
+
+  size_t hist[500] = {0};
+  for (int i = 0; i < n; i++) {
+    key_t key = rand() % 500;
+    node_t *p = rbtree_insert(t, key);
+    assert(p != NULL && p->key == key);
+    hist[key]++;
+  }
+
+  for (int i = 0; i < 4 * n; i++) {
+    key_t key = rand() % 500;
+    node_t *p = rbtree_find(t, key);
+    if (hist[key] == 0) {
+      assert(p == NULL);
+      p = rbtree_insert(t, key);
+      hist[key]++;
+      assert(rbtree_find(t, key) != NULL);
+    } else {
+      assert(p != NULL && p->key == key);
+      rbtree_erase(t, p);
+      hist[key]--;
+    }
+  }
+  test_balance_constraint(t);
+  test_search_constraint(t);
+
+  for (key_t k = 0; k < 500; k++) {
+    node_t *p = rbtree_find(t, k);
+    assert((p != NULL) == (hist[k] > 0));
+    assert(p == NULL || p->key == k);
+    assert(rbtree_count(t, k) == hist[k]);
+  }
+
+  delete_rbtree(t);
+}
+
+void test_hash_index_suite() {
+  test_hash_index(0, 2000, 29);
+  test_hash_index(1, 2000, 29);
+
+  const rbtree_opts_t opts = {.hash_index = 1};
+  rbtree *t = new_tree(&opts);
+  const key_t arr[] = {10, 5, 8, 34, 67, 23, 156, 24, 2, 12, 24, 36, 990, 25};
+  test_find_erase(t, arr, sizeof(arr) / sizeof(arr[0]));
+  delete_rbtree(t);
+}
+
+// popping from both ends should drain the tree in sorted order
+void test_pop(const int counted, const size_t n, const unsigned int seed) {
+  srand(seed);
+  const rbtree_opts_t opts = {.counted = counted};
+  rbtree *t = new_tree(&opts);
+  assert(t != NULL);
+  assert(rbtree_min(t) == NULL && rbtree_max(t) == NULL);
+
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 4);
+    rbtree_insert(t, arr[i]);
+  }
+  qsort((void *)arr, n, sizeof(key_t), comp);
+
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    assert(rbtree_min(t)->key == arr[lo]);
+    assert(rbtree_max(t)->key == arr[hi - 1]);
+    key_t key;
+    if (rand() % 2) {
+      assert(rbtree_pop_min(t, &key) == 0);
+      assert(key == arr[lo++]);
+    } else {
+      assert(rbtree_pop_max(t, &key) == 0);
+      assert(key == arr[--hi]);
+    }
+    if ((lo + hi) % 64 == 0) {
+      test_balance_constraint(t);
+      test_search_constraint(t);
+    }
+  }
+  assert(rbtree_min(t) == NULL && rbtree_max(t) == NULL);
+  assert(rbtree_pop_min(t, NULL) == -1);
+  assert(rbtree_pop_max(t, NULL) == -1);
+#ifdef SENTINEL
+  assert(t->root == t->nil);
+#endif
+
+  free(arr);
+  delete_rbtree(t);
+}
+
+void test_pop_suite() {
+  test_pop(0, 4000, 30);
+  test_pop(1, 4000, 30);
+}
+
+// caller-owned objects with the node embedded away from offset 0
+typedef struct {
+  int payload;
+  node_t node;
+} item_t;
+
+typedef struct {
+  int payload;
+  rbtree_aug_node_t link;
+} aug_item_t;
+
+// intrusive link/unlink should behave like insert/erase without allocating
+void test_intrusive(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_tree(NULL);
+  item_t *items = calloc(n, sizeof(item_t));
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    items[i].payload = i;
+    items[i].node.key = arr[i] = rand() % 1000;
+    assert(rbtree_link(t, &items[i].node) == &items[i].node);
+  }
+  test_balance_constraint(t);
+  test_search_constraint(t);
+
+  for (int i = 0; i < n; i++) {
+    node_t *p = rbtree_find(t, arr[i]);
+    assert(p != NULL);
+    item_t *it = rbtree_entry(p, item_t, node);
+    assert(it >= items && it < items + n && arr[it->payload] == arr[i]);
+  }
+
+  // erase and pop would free the caller's objects, so they refuse
+  key_t popped;
+  node_t *first = rbtree_min(t);
+  assert(rbtree_pop_min(t, &popped) == -1);
+  assert(rbtree_pop_max(t, &popped) == -1);
+  assert(rbtree_erase(t, first) == -1);
+  assert(rbtree_min(t) == first);
+  assert(rbtree_memory_usage(t).node_count == n);
+
+  // unlink the odd items; the objects stay valid and can be relinked
+  for (int i = 1; i < n; i += 2) {
+    assert(rbtree_unlink(t, &items[i].node) == 0);
+  }
+  test_balance_constraint(t);
+  test_search_constraint(t);
+  for (int i = 1; i < n; i += 2) {
+    assert(rbtree_link(t, &items[i].node) != NULL);
+  }
+  test_balance_constraint(t);
+  test_search_constraint(t);
+
+  qsort((void *)arr, n, sizeof(key_t), comp);
+  key_t *res = calloc(n, sizeof(key_t));
+  rbtree_to_array(t, res, n);
+  for (int i = 0; i < n; i++) {
+    assert(arr[i] == res[i]);
+  }
+  assert(rbtree_min(t)->key == arr[0]);
+  assert(rbtree_max(t)->key == arr[n - 1]);
+
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_unlink(t, &items[i].node) == 0);
+  }
+#ifdef SENTINEL
+  assert(t->root == t->nil);
+#endif
+  assert(rbtree_min(t) == NULL);
+
+  free(res);
+  free(arr);
+  free(items);
+  delete_rbtree(t);
+}
+
+// augmented trees take intrusive nodes with room for the aggregate
+void test_intrusive_augment(const size_t n) {
+  const rbtree_monoid_t sum = {0, sum_lift, sum_combine};
+  const rbtree_opts_t opts = {.augment = &sum};
+  rbtree *t = new_tree(&opts);
+  aug_item_t *items = calloc(n, sizeof(aug_item_t));
+  for (int i = 0; i < n; i++) {
+    items[i].link.node.key = i;
+    rbtree_link(t, &items[i].link.node);
+  }
+  for (int i = 0; i < n; i += 2) {
+    rbtree_unlink(t, &items[i].link.node);
+  }
+  // odd keys 1, 3, ..., n - 1 remain
+  assert(rbtree_aggregate(t, 0, n) == (agg_t)(n / 2) * (n / 2));
+  free(items);
+  delete_rbtree(t);
+
+  // counted trees merge duplicates and refuse caller-owned nodes
+  const rbtree_opts_t counted = {.counted = 1};
+  t = new_tree(&counted);
+  item_t item = {.node.key = 1};
+  assert(rbtree_link(t, &item.node) == NULL);
+  assert(rbtree_unlink(t, &item.node) == -1);
+  delete_rbtree(t);
+}
+
+void test_intrusive_suite() {
+  test_intrusive(3000, 31);
+  test_intrusive_augment(1000);
+}
+
+typedef struct {
+  shardtree *s;
+  const key_t *keys;
+  size_t n;
+} shard_writer_t;
+
+static void *shard_writer(void *arg) {
+  shard_writer_t *w = (shard_writer_t *)arg;
+  const int shard = shardtree_claim(w->s);
+  assert(shard >= 0);
+  for (size_t i = 0; i < w->n; i++) {
+    node_t *p = shardtree_insert(w->s, shard, w->keys[i]);
+    assert(p != NULL && p->key == w->keys[i]);
+  }
+  return NULL;
+}
+
+// concurrent writers on their own shards should merge into one sorted view
+void test_shardtree(const int counted, const size_t nthreads,
+                    const size_t per_thread, const unsigned int seed) {
+  srand(seed);
+  const rbtree_opts_t opts = {.counted = counted, .engine = TEST_ENGINE};
+  shardtree *s = new_shardtree(nthreads, &opts);
+  const size_t n = nthreads * per_thread;
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 2);
+  }
+
+  pthread_t *tids = calloc(nthreads, sizeof(pthread_t));
+  shard_writer_t *writers = calloc(nthreads, sizeof(shard_writer_t));
+  for (size_t i = 0; i < nthreads; i++) {
+    writers[i] = (shard_writer_t){s, arr + i * per_thread, per_thread};
+    assert(pthread_create(&tids[i], NULL, shard_writer, &writers[i]) == 0);
+  }
+  for (size_t i = 0; i < nthreads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  assert(shardtree_claim(s) == -1);
+  assert(shardtree_insert(s, -1, 0) == NULL);
+  assert(shardtree_insert(s, nthreads, 0) == NULL);
+  for (size_t i = 0; i < nthreads; i++) {
+    test_balance_constraint(s->shards[i]);
+    test_search_constraint(s->shards[i]);
+  }
+
+  qsort((void *)arr, n, sizeof(key_t), comp);
+  assert(shardtree_min(s, NULL)->key == arr[0]);
+  assert(shardtree_max(s, NULL)->key == arr[n - 1]);
+
+  key_t *res = calloc(n, sizeof(key_t));
+  shardtree_to_array(s, res, n);
+  for (int i = 0; i < n; i++) {
+    assert(arr[i] == res[i]);
+  }
+
+  int shard;
+  node_t *p = shardtree_find(s, arr[n / 2], &shard);
+  assert(p != NULL && p->key == arr[n / 2]);
+  assert(rbtree_find(s->shards[shard], arr[n / 2]) != NULL);
+
+  free(res);
+  free(writers);
+  free(tids);
+  free(arr);
+  delete_shardtree(s);
+}
+
+void test_shardtree_suite() {
+  test_shardtree(0, 4, 2000, 32);
+  test_shardtree(1, 3, 2000, 33);
+}
+
+// counting shim: every block the tree allocates must come back
+typedef struct {
+  size_t blocks, bytes;
+} alloc_counter_t;
+
+static void *counting_alloc(void *ctx, const size_t size) {
+  alloc_counter_t *c = (alloc_counter_t *)ctx;
+  c->blocks++;
+  c->bytes += size;
+  return malloc(size);
+}
+
+static void counting_free(void *ctx, void *ptr, const size_t size) {
+  alloc_counter_t *c = (alloc_counter_t *)ctx;
+  c->blocks--;
+  c->bytes -= size;
+  free(ptr);
+}
+
+// memory usage should match the allocator's view and delete should free all
+void test_memory_usage(const int hash_index, const size_t n) {
+  alloc_counter_t counter = {0, 0};
+  const rbtree_allocator_t shim = {counting_alloc, counting_free, NULL, 0,
+                                   &counter};
+  const rbtree_opts_t opts = {.hash_index = hash_index, .allocator = &shim};
+  rbtree *t = new_tree(&opts);
+
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, i % (n / 2));
+  }
+  for (int i = 0; i < n / 4; i++) {
+    rbtree_erase(t, rbtree_find(t, i));
+  }
+
+  rbtree_memory_t usage = rbtree_memory_usage(t);
+  assert(usage.node_count == n - n / 4);
+  assert(usage.live_bytes == counter.bytes);
+  assert(usage.live_bytes >= sizeof(rbtree) + (n - n / 4 + 1) * t->node_size);
+  assert(usage.overhead_bytes == 0);
+  assert(hash_index || usage.slack_bytes == 0);
+
+  delete_rbtree(t);
+  assert(counter.blocks == 0);
+  assert(counter.bytes == 0);
+
+  // the libc allocator reports per-block bookkeeping and, on glibc,
+  // rounding slack
+  t = new_tree(NULL);
+  rbtree_insert(t, 1);
+  usage = rbtree_memory_usage(t);
+  assert(usage.node_count == 1);
+  assert(usage.live_bytes == sizeof(rbtree) + 2 * t->node_size);
+#ifdef __GLIBC__
+  assert(usage.overhead_bytes == 3 * sizeof(size_t));
+#else
+  assert(usage.overhead_bytes == 0 && usage.slack_bytes == 0);
+#endif
+  delete_rbtree(t);
+}
+
+// a tree refuses to mix its own nodes with caller-owned ones, so delete
+// can free everything it allocated
+void test_memory_ownership(const size_t n) {
+  alloc_counter_t counter = {0, 0};
+  const rbtree_allocator_t shim = {counting_alloc, counting_free, NULL, 0,
+                                   &counter};
+  const rbtree_opts_t opts = {.allocator = &shim};
+  item_t item = {.node.key = 1};
+
+  rbtree *t = new_tree(&opts);
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_insert(t, i) != NULL);
+  }
+  assert(rbtree_link(t, &item.node) == NULL);
+  // unlinking a tree-made node would leak it and wrap the foreign count
+  assert(rbtree_unlink(t, rbtree_min(t)) == -1);
+  assert(rbtree_insert(t, n) != NULL);
+  assert(rbtree_memory_usage(t).node_count == n + 1);
+  delete_rbtree(t);
+  assert(counter.blocks == 0);
+  assert(counter.bytes == 0);
+
+  t = new_tree(&opts);
+  assert(rbtree_link(t, &item.node) == &item.node);
+  assert(rbtree_insert(t, 2) == NULL);
+  assert(rbtree_memory_usage(t).node_count == 1);
+  assert(rbtree_unlink(t, &item.node) == 0);
+  // once the caller's nodes are gone the tree may allocate again
+  assert(rbtree_insert(t, 2) != NULL);
+  delete_rbtree(t);
+  assert(counter.blocks == 0);
+  assert(counter.bytes == 0);
+}
+
+void test_memory_usage_suite() {
+  test_memory_usage(0, 2000);
+  test_memory_usage(1, 2000);
+  test_memory_ownership(100);
+}
+
+// interleaved lookups should return exactly what rbtree_find returns
+void test_batchfind(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_tree(NULL);
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, rand() % (2 * n));
+  }
+
+  const size_t nkeys = 3 * n;
+  key_t *keys = calloc(nkeys, sizeof(key_t));
+  node_t **res = calloc(nkeys, sizeof(node_t *));
+  for (int i = 0; i < nkeys; i++) {
+    keys[i] = rand() % (2 * n + 10) - 5;
+  }
+
+  const size_t inflight[] = {1, 7, 32};
+  for (int k = 0; k < sizeof(inflight) / sizeof(inflight[0]); k++) {
+    batchfind_run(t, keys, res, nkeys, inflight[k]);
+    for (int i = 0; i < nkeys; i++) {
+      assert(res[i] == rbtree_find(t, keys[i]));
+    }
+  }
+
+  // submit/complete: keep the engine full, match results by tag
+  batchfind *b = new_batchfind(t, 8);
+  batchfind_result_t out[4];
+  size_t submitted = 0, completed = 0;
+  memset(res, 0, nkeys * sizeof(node_t *));
+  while (completed < nkeys) {
+    while (submitted < nkeys &&
+           batchfind_submit(b, keys[submitted], &res[submitted]) == 0) {
+      submitted++;
+    }
+    size_t done = batchfind_complete(b, out, 4);
+    assert(done > 0 && done <= 4);
+    for (size_t i = 0; i < done; i++) {
+      *(node_t **)out[i].tag = out[i].node;
+    }
+    completed += done;
+  }
+  assert(batchfind_complete(b, out, 4) == 0);
+  for (int i = 0; i < nkeys; i++) {
+    assert(res[i] == rbtree_find(t, keys[i]));
+  }
+
+  delete_batchfind(b);
+  free(res);
+  free(keys);
+  delete_rbtree(t);
+}
+
+// compaction should keep contents and place nodes in the requested order
+void test_compact(const rbtree_opts_t *base, const rbtree_layout_t layout,
+                  const size_t n, const unsigned int seed) {
+  srand(seed);
+  const rbtree_monoid_t sum = {0, sum_lift, sum_combine};
+  alloc_counter_t counter = {0, 0};
+  const rbtree_allocator_t shim = {counting_alloc, counting_free, NULL, 0,
+                                   &counter};
+  rbtree_opts_t opts = *base;
+  opts.augment = base->augment != NULL ? &sum : NULL;
+  opts.allocator = &shim;
+  rbtree *t = new_tree(&opts);
+
+  // churn so that neighbours end up far apart in memory
+  size_t count = n;
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, rand() % n);
+  }
+  for (int i = 0; i < n / 2; i++) {
+    node_t *p = rbtree_find(t, rand() % n);
+    if (p != NULL) {
+      rbtree_erase(t, p);
+      count--;
+    }
+  }
+  key_t *before = calloc(count, sizeof(key_t));
+  key_t *after = calloc(count, sizeof(key_t));
+  rbtree_to_array(t, before, count);
+  const agg_t agg = opts.augment ? rbtree_aggregate(t, 0, n) : 0;
+
+  assert(rbtree_compact(t, layout) == 0);
+  test_balance_constraint(t);
+  test_search_constraint(t);
+  assert(check_parent_links(t));
+  rbtree_to_array(t, after, count);
+  assert(memcmp(before, after, count * sizeof(key_t)) == 0);
+  assert(!opts.augment || rbtree_aggregate(t, 0, n) == agg);
+  for (int i = 0; i < count; i++) {
+    assert(rbtree_find(t, before[i])->key == before[i]);
+  }
+  assert(rbtree_min(t)->key == before[0]);
+  assert(rbtree_max(t)->key == before[count - 1]);
+
+  const char *slot = (const char *)rbtree_min(t);
+  if (layout == RBTREE_LAYOUT_INORDER) {
+    // an in-order walk now strides through one block
+    for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) {
+      assert((const char *)p == slot);
+      slot += t->node_size;
+    }
+  }
+  else {
+    // van Emde Boas order starts with the root
+    assert((const char *)t->root < slot);
+  }
+  assert(rbtree_memory_usage(t).slack_bytes == 0 || opts.hash_index);
+
+  // a compaction resumes across mutations between its slices
+  assert(rbtree_compact_step(t, !layout, count / 3) == 0);
+  rbtree_insert(t, n + 1);
+  rbtree_erase(t, rbtree_find(t, n + 1));
+  test_balance_constraint(t);
+  test_search_constraint(t);
+  assert(check_parent_links(t));
+  rbtree_to_array(t, after, count);
+  assert(memcmp(before, after, count * sizeof(key_t)) == 0);
+  assert(rbtree_compact_step(t, !layout, count) == 1);
+
+  // bounded slices finish the job
+  int steps = 0;
+  while (rbtree_compact_step(t, layout, 64) == 0) {
+    steps++;
+  }
+  assert(steps == t->node_count / 64);
+  rbtree_to_array(t, after, count);
+  assert(memcmp(before, after, count * sizeof(key_t)) == 0);
+  for (int i = 0; i < count; i++) {
+    assert(rbtree_find(t, before[i])->key == before[i]);
+  }
+
+  // erasing everything hands the block back
+  for (int i = 0; i < count; i++) {
+    rbtree_erase(t, rbtree_find(t, before[i]));
+  }
+  assert(rbtree_min(t) == NULL);
+  assert(rbtree_compact(t, layout) == 0);
+  for (int i = 0; i < 100; i++) {
+    rbtree_insert(t, i);
+  }
+  assert(rbtree_compact_step(t, layout, 10) == 0);
+  free(after);
+  free(before);
+  delete_rbtree(t);
+  assert(counter.blocks == 0);
+  assert(counter.bytes == 0);
+
+  // caller-owned nodes cannot be moved
+  t = new_tree(NULL);
+  item_t item = {.node.key = 1};
+  rbtree_link(t, &item.node);
+  assert(rbtree_compact(t, layout) == -1);
+  rbtree_unlink(t, &item.node);
+  delete_rbtree(t);
+}
+
+// only compaction moves nodes; inserts and erases leave the rest in place
+void test_compact_pointers(const rbtree_layout_t layout) {
+  rbtree *t = new_tree(NULL);
+  node_t *held[100];
+
+  for (int i = 0; i < 100; i++) {
+    rbtree_insert(t, i);
+  }
+  assert(rbtree_compact(t, layout) == 0);
+  for (int i = 0; i < 100; i++) {
+    held[i] = rbtree_find(t, i);
+  }
+  // emptying most of the block must not move the survivors out of it
+  for (int i = 0; i < 76; i++) {
+    assert(rbtree_erase(t, rbtree_find(t, i)) == 0);
+  }
+  for (int i = 76; i < 100; i++) {
+    assert(held[i]->key == i);
+    assert(rbtree_find(t, i) == held[i]);
+  }
+  // new nodes refill the freed slots
+  const rbtree_memory_t usage = rbtree_memory_usage(t);
+  for (int i = 0; i < 76; i++) {
+    held[i] = rbtree_insert(t, i);
+  }
+  assert(rbtree_memory_usage(t).live_bytes == usage.live_bytes);
+  assert(t->reuse == NULL);
+  for (int i = 0; i < 100; i++) {
+    assert(held[i]->key == i);
+    assert(rbtree_find(t, i) == held[i]);
+  }
+
+  // between slices too
+  assert(rbtree_compact_step(t, !layout, 30) == 0);
+  for (int i = 0; i < 100; i++) {
+    held[i] = rbtree_find(t, i);
+  }
+  for (int i = 0; i < 100; i += 2) {
+    assert(rbtree_erase(t, held[i]) == 0);
+  }
+  for (int i = 1; i < 100; i += 2) {
+    assert(held[i]->key == i);
+    assert(rbtree_find(t, i) == held[i]);
+  }
+  while (rbtree_compact_step(t, !layout, 30) == 0)
+    ;
+  assert(rbtree_memory_usage(t).node_count == 50);
+  test_balance_constraint(t);
+  test_search_constraint(t);
+  assert(check_parent_links(t));
+  delete_rbtree(t);
+}
+
+// a compaction must finish even with inserts and erases between every slice
+void test_compact_interleaved(const rbtree_layout_t layout, const size_t n,
+                              const size_t budget, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_tree(NULL);
+  key_t *keys = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    keys[i] = rand();
+    rbtree_insert(t, keys[i]);
+  }
+
+  size_t slices = 0;
+  int done = 0;
+  while (!done) {
+    done = rbtree_compact_step(t, layout, budget);
+    assert(done >= 0);
+    slices++;
+    assert(slices <= 2 * n / budget + 2);
+    for (int k = 0; k < 10; k++) {
+      const int j = rand() % n;
+      assert(rbtree_erase(t, rbtree_find(t, keys[j])) == 0);
+      keys[j] = rand();
+      rbtree_insert(t, keys[j]);
+    }
+  }
+  test_balance_constraint(t);
+  test_search_constraint(t);
+  assert(check_parent_links(t));
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_find(t, keys[i]) != NULL);
+  }
+
+  free(keys);
+  delete_rbtree(t);
+}
+
+// restarting bounded slices over and over must not pile up arenas
+void test_compact_cancel(const size_t n, const size_t budget,
+                         const int rounds, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_tree(NULL);
+  key_t *keys = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    keys[i] = rand();
+    rbtree_insert(t, keys[i]);
+  }
+  const size_t baseline = rbtree_memory_usage(t).live_bytes;
+
+  for (int r = 0; r < rounds; r++) {
+    const rbtree_layout_t layout =
+        r % 3 == 2 ? RBTREE_LAYOUT_VEB : RBTREE_LAYOUT_INORDER;
+    assert(rbtree_compact_step(t, layout, budget) >= 0);
+    for (int k = 0; k < 100; k++) {
+      const int j = rand() % n;
+      assert(rbtree_erase(t, rbtree_find(t, keys[j])) == 0);
+      keys[j] = rand();
+      rbtree_insert(t, keys[j]);
+    }
+    // each restart empties the arenas left under a quarter full
+    const rbtree_memory_t usage = rbtree_memory_usage(t);
+    assert(usage.node_count == n);
+    assert(usage.live_bytes <= 4 * baseline);
+    assert(t->narenas <= 4 * n / budget + 2);
+  }
+  test_balance_constraint(t);
+  test_search_constraint(t);
+  assert(check_parent_links(t));
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_find(t, keys[i]) != NULL);
+  }
+
+  free(keys);
+  delete_rbtree(t);
+}
+
+void test_compact_suite() {
+  const rbtree_monoid_t sum = {0, sum_lift, sum_combine};
+  const rbtree_opts_t plain = {0};
+  const rbtree_opts_t augmented = {.augment = &sum};
+  const rbtree_opts_t counted = {.counted = 1};
+  const rbtree_opts_t indexed = {.hash_index = 1};
+  test_compact(&plain, RBTREE_LAYOUT_INORDER, 3000, 35);
+  test_compact(&plain, RBTREE_LAYOUT_VEB, 3000, 36);
+  test_compact(&augmented, RBTREE_LAYOUT_VEB, 2000, 37);
+  test_compact(&counted, RBTREE_LAYOUT_INORDER, 2000, 38);
+  test_compact(&indexed, RBTREE_LAYOUT_VEB, 2000, 39);
+  test_compact_cancel(20000, 6000, 50, 40);
+  test_compact_pointers(RBTREE_LAYOUT_INORDER);
+  test_compact_pointers(RBTREE_LAYOUT_VEB);
+  test_compact_interleaved(RBTREE_LAYOUT_INORDER, 20000, 500, 41);
+  test_compact_interleaved(RBTREE_LAYOUT_VEB, 20000, 500, 42);
+}
+
+static int tree_height(const rbtree *t, const node_t *p) {
+  if (p == t->nil) {
+    return 0;
+  }
+  const int l = tree_height(t, p->left);
+  const int r = tree_height(t, p->right);
+  return 1 + (l > r ? l : r);
+}
+
+// sorted input is the worst case for an unbalanced tree; every engine
+// must stay within its height bound and count the rotations it did
+void test_engine_height(const size_t n) {
+  rbtree *t = new_tree(NULL);
+  assert(t->engine == TEST_ENGINE);
+  int log2n = 0;
+  while ((1u << log2n) < n) {
+    log2n++;
+  }
+
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, i);
+  }
+  assert(t->rotations > 0);
+  const int h = tree_height(t, t->root);
+  switch (t->engine) {
+    case RBTREE_ENGINE_AVL:
+      assert(h <= 1.45 * log2n + 1);
+      break;
+    case RBTREE_ENGINE_TREAP:
+      // expected 2 ln n; this bound holds for the fixed priority stream
+      assert(h <= 4 * log2n);
+      break;
+    default:
+      assert(h <= 2 * log2n);
+      break;
+  }
+
+  // erasing every other key keeps the bound of the smaller tree
+  for (int i = 0; i < n; i += 2) {
+    rbtree_erase(t, rbtree_find(t, i));
+  }
+  test_balance_constraint(t);
+  assert(tree_height(t, t->root) <= h);
+  delete_rbtree(t);
+}
+
 int main(void) {
   test_init();
   test_insert_single(1024);
@@ -381,5 +1191,15 @@ int main(void) {
   test_duplicate_values();
   test_multi_instance();
   test_find_erase_rand(10000, 17);
+  test_augment_suite();
+  test_count_suite();
+  test_hash_index_suite();
+  test_pop_suite();
+  test_intrusive_suite();
+  test_shardtree_suite();
+  test_memory_usage_suite();
+  test_batchfind(5000, 34);
+  test_compact_suite();
+  test_engine_height(1 << 14);
   printf("Passed all tests!\n");
 }